@@ -0,0 +1,103 @@
+/**
+ * Throughput benchmark for parse_command/free_command, without the REPL.
+ * Reports commands parsed per second and heap allocations per command on
+ * a corpus of realistic and pathological lines.
+ *
+ * Build: gcc -O2 -o parse_bench bench/parse_bench.c
+ * Usage: ./parse_bench [seconds_per_case]
+ */
+#define SEASHELL_NO_MAIN
+#include "../seashell.c"
+
+/// count heap allocations by wrapping the glibc allocator
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+static unsigned long allocations;
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+void *calloc(size_t n, size_t size)
+{
+	allocations++;
+	return __libc_calloc(n, size);
+}
+void *realloc(void *p, size_t size)
+{
+	allocations++;
+	return __libc_realloc(p, size);
+}
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+/**
+ * Build a line by repeating a fragment
+ */
+static char *repeat(const char *head, const char *fragment, int count, const char *tail)
+{
+	size_t len=strlen(head)+strlen(fragment)*count+strlen(tail);
+	char *line=__libc_malloc(len+1), *p=line;
+	p=stpcpy(p, head);
+	for (int i=0;i<count;++i)
+		p=stpcpy(p, fragment);
+	strcpy(p, tail);
+	return line;
+}
+static void bench_case(const char *label, const char *line, double seconds)
+{
+	size_t len=strlen(line);
+	char *buf=__libc_malloc(len+1);
+	unsigned long count=0, allocs_before;
+	double start=now(), elapsed;
+
+	// warm up the arena so steady state is measured
+	memcpy(buf, line, len+1);
+	struct command_t *command=arena_calloc(&command_arena, sizeof(struct command_t));
+	parse_command(buf, command);
+	free_command(command);
+
+	allocs_before=allocations;
+	do
+	{
+		for (int i=0;i<64;++i)
+		{
+			memcpy(buf, line, len+1); // the parser works in place
+			command=arena_calloc(&command_arena, sizeof(struct command_t));
+			parse_command(buf, command);
+			free_command(command);
+		}
+		count+=64;
+		elapsed=now()-start;
+	} while (elapsed<seconds);
+
+	printf("%-28s %8zu B  %12.0f cmds/s  %8.1f MB/s  %6.2f allocs/cmd\n", label, len,
+		count/elapsed, count*(double)len/elapsed/1e6, (double)(allocations-allocs_before)/count);
+	__libc_free(buf);
+}
+int main(int argc, char *argv[])
+{
+	double seconds=argc>1?atof(argv[1]):0.5;
+	struct {
+		const char *label;
+		char *line;
+	} corpus[]={
+		{"simple", strdup("ls -la /tmp")},
+		{"quoted", strdup("grep -rn \"hello world\" 'src dir' a\\ b | sort | uniq -c > out.txt &")},
+		{"redirects", strdup("sort < in.txt > out.txt")},
+		{"pipeline x100", repeat("cat file", " | grep -v x", 100, "")},
+		{"redirects x1000", repeat("cmd", " < in > out >> log", 1000, "")},
+		{"args x10k", repeat("echo", " argument", 10000, "")},
+		{"quoted args x10k", repeat("echo", " \"quoted arg\" 'single' esc\\ aped", 3333, "")},
+		{"one 1MB argument", repeat("echo ", "xxxxxxxxxxxxxxxx", 65536, "")},
+	};
+	for (size_t i=0;i<sizeof(corpus)/sizeof(corpus[0]);++i)
+		bench_case(corpus[i].label, corpus[i].line, seconds);
+	return 0;
+}
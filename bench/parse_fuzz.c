@@ -0,0 +1,64 @@
+/**
+ * libFuzzer entry point for parse_command/free_command.
+ * Every input is parsed as one line and the resulting command chain is
+ * checked for consistency; sanitizers catch out-of-bounds accesses.
+ *
+ * Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o parse_fuzz bench/parse_fuzz.c
+ * Without libFuzzer (replays the files given on the command line):
+ *        gcc -g -fsanitize=address,undefined -DFUZZ_STANDALONE -o parse_fuzz bench/parse_fuzz.c
+ */
+#define SEASHELL_NO_MAIN
+#include "../seashell.c"
+#include <assert.h>
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	(void)argc;
+	(void)argv;
+	freopen("/dev/null", "w", stdout); // syntax errors are expected
+	return 0;
+}
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	char *buf=malloc(size+1);
+	memcpy(buf, data, size);
+	buf[size]=0;
+
+	struct command_t *command=arena_calloc(&command_arena, sizeof(struct command_t));
+	parse_command(buf, command);
+	for (struct command_t *c=command;c;c=c->next)
+	{
+		assert(c->name!=NULL);
+		assert(c->arg_count==0 || c->args!=NULL);
+		for (int i=0;i<c->arg_count;++i)
+			assert(c->args[i]>=buf && c->args[i]<=buf+size); // spans of the input
+		for (int i=0;i<3;++i)
+			assert(c->redirects[i]==NULL || (c->redirects[i]>=buf && c->redirects[i]<=buf+size));
+	}
+	free_command(command);
+	free(buf);
+	return 0;
+}
+#ifdef FUZZ_STANDALONE
+int main(int argc, char *argv[])
+{
+	LLVMFuzzerInitialize(&argc, &argv);
+	for (int i=1;i<argc;++i)
+	{
+		FILE *f=fopen(argv[i], "rb");
+		if (f==NULL) continue;
+		char *data=NULL;
+		size_t size=0;
+		FILE *mem=open_memstream(&data, &size);
+		char chunk[4096];
+		size_t n;
+		while ((n=fread(chunk, 1, sizeof(chunk), f))>0)
+			fwrite(chunk, 1, n, mem);
+		fclose(mem);
+		fclose(f);
+		LLVMFuzzerTestOneInput((unsigned char *)data, size);
+		free(data);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,61 @@
+/**
+ * Regression test for pipelines whose reader quits early. A stage that
+ * writes more than the pipe holds must get EPIPE once head exits, which
+ * only happens if no stage still holds a reader of its own output pipe.
+ * A hang is reported through the alarm.
+ *
+ * Build: gcc -O2 -pthread -o pipeline_test bench/pipeline_test.c
+ * Usage: ./pipeline_test
+ */
+#define SEASHELL_NO_MAIN
+#include "../seashell.c"
+
+#define TEST_TIMEOUT 20 // seconds
+#define TEST_LINES 2000000 // about 60 MB, far more than a pipe buffer
+
+static const char *lines[]={
+	"highlight ERROR r %s | head -1 > /dev/null", // forked builtin stage
+	"cat %s | highlight ERROR r | head -1 > /dev/null", // thread stage
+};
+static char path[]="/tmp/pipeline_test.XXXXXX";
+
+static void timeout(int sig)
+{
+	(void)sig;
+	static const char message[]="FAIL: pipeline still running, a stage never saw EPIPE\n";
+	if (write(STDERR_FILENO, message, sizeof(message)-1)==-1) {}
+	unlink(path);
+	_exit(1);
+}
+int main()
+{
+	int fd=mkstemp(path);
+	if (fd==-1)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	FILE *file=fdopen(fd, "w");
+	for (int i=0;i<TEST_LINES;++i)
+		fprintf(file, "%d ERROR some log line\n", i);
+	fclose(file);
+
+	jobs_init(false);
+	signal(SIGALRM, timeout);
+	for (size_t i=0;i<sizeof(lines)/sizeof(lines[0]);++i)
+	{
+		char line[256], text[256];
+		snprintf(text, sizeof(text), lines[i], path);
+		strcpy(line, text); // parsed in place
+		struct command_t *command=arena_calloc(&command_arena, sizeof(struct command_t));
+		parse_command(line, command);
+		alarm(TEST_TIMEOUT);
+		process_command(command);
+		alarm(0);
+		free_command(command);
+		arena_reset(&command_arena);
+		printf("ok: %s\n", text);
+	}
+	unlink(path);
+	return 0;
+}
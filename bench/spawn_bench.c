@@ -0,0 +1,75 @@
+/**
+ * Spawn-rate benchmark for seashell's external command launch path.
+ * Compares the old fork()+execv() launch against launch_process()
+ * (posix_spawn) while the shell holds a configurable resident set.
+ *
+ * Build: gcc -O2 -o spawn_bench bench/spawn_bench.c
+ * Usage: ./spawn_bench [iterations] [resident_mb] [program]
+ */
+#define SEASHELL_NO_MAIN
+#include "../seashell.c"
+#include <time.h>
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+static double bench_fork(const char *path, char **argv, int iterations)
+{
+	double start=now();
+	for (int i=0;i<iterations;++i)
+	{
+		pid_t pid=fork();
+		if (pid==0)
+		{
+			execv(path, argv);
+			_exit(127);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return now()-start;
+}
+static double bench_spawn(const char *path, char **argv, int iterations)
+{
+	struct launch_t launch={.path=path, .argv=argv, .fds={-1, -1, -1}, .pgid=0};
+	double start=now();
+	for (int i=0;i<iterations;++i)
+	{
+		pid_t pid=launch_process(&launch);
+		if (pid==-1)
+		{
+			perror("launch_process");
+			exit(1);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return now()-start;
+}
+int main(int argc, char *argv[])
+{
+	int iterations=argc>1?atoi(argv[1]):2000;
+	size_t resident_mb=argc>2?strtoul(argv[2], NULL, 10):256;
+	const char *program=argc>3?argv[3]:"true";
+
+	// emulate a shell with a large resident set, every page touched
+	char *ballast=malloc(resident_mb<<20);
+	memset(ballast, 1, resident_mb<<20);
+
+	const char *path=resolve_executable(program);
+	if (path==NULL)
+	{
+		fprintf(stderr, "%s: not found\n", program);
+		return 1;
+	}
+	char *child_argv[]={(char *)program, NULL};
+
+	double t_fork=bench_fork(path, child_argv, iterations);
+	double t_spawn=bench_spawn(path, child_argv, iterations);
+	printf("resident set: %zu MB, %d launches of %s\n", resident_mb, iterations, path);
+	printf("fork+execv:  %8.0f spawns/s\n", iterations/t_fork);
+	printf("posix_spawn: %8.0f spawns/s (%.2fx)\n", iterations/t_spawn, t_fork/t_spawn);
+	free(ballast);
+	return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdio.h>
@@ -5,7 +6,28 @@
 #include <termios.h>            //termios, TCSANOW, ECHO, ICANON
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 const char * sysname = "seashell";
 
@@ -23,6 +45,91 @@ struct command_t {
 	char *redirects[3]; // in/out redirection
 	struct command_t *next; // for piping
 };
+/**
+ * Bump allocator for the lifetime of one command. The parser and the
+ * builtins take their memory from command_arena, which is released in one
+ * go by arena_reset() once process_command returns, so nothing leaks
+ * between prompts and a long-lived shell keeps a flat RSS.
+ */
+#define ARENA_CHUNK_SIZE (64*1024)
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(max_align_t) char data[];
+};
+struct arena_t {
+	struct arena_chunk *head; // chunk being filled
+};
+static struct arena_t command_arena;
+/**
+ * Allocate uninitialized memory from an arena
+ * @param  arena [description]
+ * @param  size  [description]
+ * @return       memory aligned for any type, valid until arena_reset
+ */
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	size=(size+_Alignof(max_align_t)-1) & ~(_Alignof(max_align_t)-1);
+	struct arena_chunk *chunk=arena->head;
+	if (chunk==NULL || chunk->size-chunk->used<size)
+	{
+		size_t chunk_size=size>ARENA_CHUNK_SIZE?size:ARENA_CHUNK_SIZE;
+		chunk=malloc(sizeof(struct arena_chunk)+chunk_size);
+		chunk->size=chunk_size;
+		chunk->used=0;
+		if (chunk_size>ARENA_CHUNK_SIZE && arena->head)
+		{ // oversized block, keep filling the current chunk afterwards
+			chunk->next=arena->head->next;
+			arena->head->next=chunk;
+		}
+		else
+		{
+			chunk->next=arena->head;
+			arena->head=chunk;
+		}
+	}
+	void *p=chunk->data+chunk->used;
+	chunk->used+=size;
+	return p;
+}
+void *arena_calloc(struct arena_t *arena, size_t size)
+{
+	return memset(arena_alloc(arena, size), 0, size);
+}
+char *arena_strndup(struct arena_t *arena, const char *str, size_t len)
+{
+	char *copy=arena_alloc(arena, len+1);
+	memcpy(copy, str, len);
+	copy[len]=0;
+	return copy;
+}
+char *arena_strdup(struct arena_t *arena, const char *str)
+{
+	return arena_strndup(arena, str, strlen(str));
+}
+/**
+ * Release everything allocated from an arena, keeping one regular chunk
+ * around for the next command
+ * @param arena [description]
+ */
+void arena_reset(struct arena_t *arena)
+{
+	struct arena_chunk *chunk=arena->head, *next, *keep=NULL;
+	for (;chunk;chunk=next)
+	{
+		next=chunk->next;
+		if (keep==NULL && chunk->size==ARENA_CHUNK_SIZE)
+		{
+			keep=chunk;
+			keep->used=0;
+			keep->next=NULL;
+		}
+		else
+			free(chunk);
+	}
+	arena->head=keep;
+}
 /**
  * Prints a command struct
  * @param struct command_t *
@@ -48,1011 +155,5979 @@ void print_command(struct command_t * command)
 
 }
 /**
- * Release allocated memory of a command
+ * Release allocated memory of a command. Commands live in command_arena,
+ * so this releases every command parsed since the last call.
  * @param  command [description]
  * @return         [description]
  */
 int free_command(struct command_t *command)
 {
-	if (command->arg_count)
+	(void)command;
+	arena_reset(&command_arena);
+	return 0;
+}
+/**
+ * Single pass lexer. Words are unquoted and unescaped in place (the result
+ * is never longer than the source) and NUL terminated inside the input
+ * buffer, so tokens are spans of the original line and nothing is copied.
+ * A terminator written over an operator character is remembered in
+ * pending so the operator is still seen by the next call.
+ */
+enum token_type {
+	TOKEN_END,
+	TOKEN_WORD,
+	TOKEN_PIPE, // |
+	TOKEN_BACKGROUND, // &
+	TOKEN_IN, // <
+	TOKEN_OUT, // >
+	TOKEN_APPEND, // >>
+};
+struct token_t {
+	enum token_type type;
+	char *start; // NUL terminated word for TOKEN_WORD
+	size_t len;
+};
+struct lexer_t {
+	char *p; // next byte to read
+	char *end;
+	char pending; // operator byte overwritten by a word terminator
+};
+// bytes that end a run of plain word characters
+static const bool word_delimiter[256]={
+	[0]=true, [' ']=true, ['\t']=true, ['\n']=true, ['|']=true, ['&']=true,
+	['<']=true, ['>']=true, ['\'']=true, ['"']=true, ['\\']=true,
+};
+/**
+ * Find the first word delimiter in [p, end), 32 or 16 bytes at a time
+ * where the CPU allows it so huge generated lines are scanned quickly
+ * @param  p   [description]
+ * @param  end [description]
+ * @return     first delimiter or end
+ */
+static char *scan_word(char *p, char *end)
+{
+#if defined(__AVX2__)
+	const __m256i space=_mm256_set1_epi8(' '), tab=_mm256_set1_epi8('\t'),
+		newline=_mm256_set1_epi8('\n'), pipe=_mm256_set1_epi8('|'),
+		amp=_mm256_set1_epi8('&'), less=_mm256_set1_epi8('<'),
+		greater=_mm256_set1_epi8('>'), squote=_mm256_set1_epi8('\''),
+		dquote=_mm256_set1_epi8('"'), backslash=_mm256_set1_epi8('\\'),
+		nul=_mm256_setzero_si256();
+	while (end-p>=32)
 	{
-		for (int i=0; i<command->arg_count; ++i)
-			free(command->args[i]);
-		free(command->args);
+		__m256i v=_mm256_loadu_si256((const __m256i *)p);
+		__m256i m=_mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, newline), _mm256_cmpeq_epi8(v, pipe))),
+			_mm256_or_si256(
+				_mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(v, amp), _mm256_cmpeq_epi8(v, less)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(v, greater), _mm256_cmpeq_epi8(v, squote))),
+				_mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(v, dquote), _mm256_cmpeq_epi8(v, backslash)),
+					_mm256_cmpeq_epi8(v, nul))));
+		unsigned int mask=_mm256_movemask_epi8(m);
+		if (mask)
+			return p+__builtin_ctz(mask);
+		p+=32;
 	}
-	for (int i=0;i<3;++i)
-		if (command->redirects[i])
-			free(command->redirects[i]);
-	if (command->next)
+#endif
+#if defined(__SSE2__)
+	const __m128i space16=_mm_set1_epi8(' '), tab16=_mm_set1_epi8('\t'),
+		newline16=_mm_set1_epi8('\n'), pipe16=_mm_set1_epi8('|'),
+		amp16=_mm_set1_epi8('&'), less16=_mm_set1_epi8('<'),
+		greater16=_mm_set1_epi8('>'), squote16=_mm_set1_epi8('\''),
+		dquote16=_mm_set1_epi8('"'), backslash16=_mm_set1_epi8('\\'),
+		nul16=_mm_setzero_si128();
+	while (end-p>=16)
 	{
-		free_command(command->next);
-		command->next=NULL;
+		__m128i v=_mm_loadu_si128((const __m128i *)p);
+		__m128i m=_mm_or_si128(
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, space16), _mm_cmpeq_epi8(v, tab16)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, newline16), _mm_cmpeq_epi8(v, pipe16))),
+			_mm_or_si128(
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, amp16), _mm_cmpeq_epi8(v, less16)),
+					_mm_or_si128(_mm_cmpeq_epi8(v, greater16), _mm_cmpeq_epi8(v, squote16))),
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, dquote16), _mm_cmpeq_epi8(v, backslash16)),
+					_mm_cmpeq_epi8(v, nul16))));
+		unsigned int mask=_mm_movemask_epi8(m);
+		if (mask)
+			return p+__builtin_ctz(mask);
+		p+=16;
 	}
-	free(command->name);
-	free(command);
-	return 0;
+#endif
+	while (p<end && !word_delimiter[(unsigned char)*p])
+		p++;
+	return p;
+}
+static char lexer_peek(struct lexer_t *lexer)
+{
+	if (lexer->pending) return lexer->pending;
+	return lexer->p<lexer->end?*lexer->p:0;
+}
+static void lexer_skip(struct lexer_t *lexer)
+{
+	if (lexer->pending) lexer->pending=0;
+	else lexer->p++;
 }
 /**
- * Show the command prompt
- * @return [description]
+ * Read the next token
+ * @param  lexer [description]
+ * @param  token filled with the token
+ * @return       0, or -1 on an unterminated quote
  */
-int show_prompt()
+int next_token(struct lexer_t *lexer, struct token_t *token)
 {
-	char cwd[1024], hostname[1024];
-    gethostname(hostname, sizeof(hostname));
-	getcwd(cwd, sizeof(cwd));
-	printf("%s@%s:%s %s$ ", getenv("USER"), hostname, cwd, sysname);
+	char c;
+	while ((c=lexer_peek(lexer))==' ' || c=='\t' || c=='\n')
+		lexer_skip(lexer);
+
+	token->start=NULL;
+	token->len=0;
+	switch (c)
+	{
+	case 0:
+		token->type=TOKEN_END;
+		return 0;
+	case '|':
+		lexer_skip(lexer);
+		token->type=TOKEN_PIPE;
+		return 0;
+	case '&':
+		lexer_skip(lexer);
+		token->type=TOKEN_BACKGROUND;
+		return 0;
+	case '<':
+		lexer_skip(lexer);
+		token->type=TOKEN_IN;
+		return 0;
+	case '>':
+		lexer_skip(lexer);
+		token->type=TOKEN_OUT;
+		if (lexer_peek(lexer)=='>')
+		{
+			lexer_skip(lexer);
+			token->type=TOKEN_APPEND;
+		}
+		return 0;
+	}
+
+	// a word; pending is empty here since pending only ever holds operators
+	char *p=lexer->p, *end=lexer->end;
+	char *out=p; // unquoted bytes are written back here
+	token->type=TOKEN_WORD;
+	token->start=p;
+	while (p<end)
+	{
+		char *run=scan_word(p, end);
+		if (out!=p)
+			memmove(out, p, run-p);
+		out+=run-p;
+		p=run;
+		if (p==end) break;
+
+		c=*p;
+		if (c=='\\')
+		{
+			if (p+1<end) // \x is a literal x
+				*out++=p[1];
+			p+=2;
+		}
+		else if (c=='\'')
+		{
+			char *close=memchr(p+1, '\'', end-p-1);
+			if (close==NULL) return -1;
+			memmove(out, p+1, close-p-1);
+			out+=close-p-1;
+			p=close+1;
+		}
+		else if (c=='"')
+		{
+			for (p++;p<end && *p!='"';p++)
+			{
+				if (*p=='\\' && p+1<end && strchr("\"\\$`", p[1]))
+					p++;
+				*out++=*p;
+			}
+			if (p==end) return -1;
+			p++;
+		}
+		else
+			break; // whitespace, operator or NUL ends the word
+	}
+	if (p>end) p=end;
+	token->len=out-token->start;
+	if (p<end && out==p && *p!=' ' && *p!='\t' && *p!='\n')
+	{ // the terminator lands on an operator, keep it for the next call
+		lexer->pending=*p;
+		p++;
+	}
+	else if (p<end && out==p)
+		p++; // terminator replaces the separating whitespace
+	*out=0;
+	lexer->p=p;
 	return 0;
 }
 /**
- * Parse a command string into a command struct
+ * Parse a command string into a command struct. Names, arguments and
+ * redirect targets point into buf, which must outlive the command.
  * @param  buf     [description]
  * @param  command [description]
- * @return         0
+ * @return         0, or -1 on a syntax error (command is then empty)
  */
 int parse_command(char *buf, struct command_t *command)
 {
-	const char *splitters=" \t"; // split at whitespace
-	int index, len;
-	len=strlen(buf);
-	while (len>0 && strchr(splitters, buf[0])!=NULL) // trim left whitespace
-	{
-		buf++;
-		len--;
-	}
-	while (len>0 && strchr(splitters, buf[len-1])!=NULL)
-		buf[--len]=0; // trim right whitespace
+	struct lexer_t lexer;
+	struct token_t token;
+	struct command_t *current=command;
+	int arg_capacity=0;
+	size_t len=strlen(buf);
 
-	if (len>0 && buf[len-1]=='?') // auto-complete
+	while (len>0 && strchr(" \t\n", buf[len-1])!=NULL)
+		len--;
+	if (len>0 && buf[len-1]=='?') // auto-complete, the ? stays part of the word
 		command->auto_complete=true;
-	if (len>0 && buf[len-1]=='&') // background
-		command->background=true;
+	lexer.p=buf;
+	lexer.end=buf+len;
+	lexer.pending=0;
 
-	char *pch = strtok(buf, splitters);
-	command->name=(char *)malloc(strlen(pch)+1);
-	if (pch==NULL)
-		command->name[0]=0;
-	else
-		strcpy(command->name, pch);
-
-	command->args=(char **)malloc(sizeof(char *));
-
-	int redirect_index;
-	int arg_index=0;
-	char temp_buf[1024], *arg;
-	while (1)
+	const char *error=NULL;
+	while (error==NULL)
 	{
-		// tokenize input on splitters
-		pch = strtok(NULL, splitters);
-		if (!pch) break;
-		arg=temp_buf;
-		strcpy(arg, pch);
-		len=strlen(arg);
-
-		if (len==0) continue; // empty arg, go for next
-		while (len>0 && strchr(splitters, arg[0])!=NULL) // trim left whitespace
+		if (next_token(&lexer, &token)==-1)
 		{
-			arg++;
-			len--;
+			error="syntax error: unterminated quote";
+			break;
 		}
-		while (len>0 && strchr(splitters, arg[len-1])!=NULL) arg[--len]=0; // trim right whitespace
-		if (len==0) continue; // empty arg, go for next
-
-		// piping to another command
-		if (strcmp(arg, "|")==0)
+		if (token.type==TOKEN_END)
+			break;
+		if (command->background) // & only terminates the line
 		{
-			struct command_t *c=malloc(sizeof(struct command_t));
-			int l=strlen(pch);
-			pch[l]=splitters[0]; // restore strtok termination
-			index=1;
-			while (pch[index]==' ' || pch[index]=='\t') index++; // skip whitespaces
-
-			parse_command(pch+index, c);
-			pch[l]=0; // put back strtok termination
-			command->next=c;
-			continue;
+			error="syntax error near `&'";
+			break;
 		}
-
-		// background process
-		if (strcmp(arg, "&")==0)
-			continue; // handled before
-
-		// handle input redirection
-		redirect_index=-1;
-		if (arg[0]=='<')
-			redirect_index=0;
-		if (arg[0]=='>')
+		switch (token.type)
 		{
-			if (len>1 && arg[1]=='>')
+		case TOKEN_WORD:
+			if (current->name==NULL)
 			{
-				redirect_index=2;
-				arg++;
-				len--;
+				current->name=token.start;
+				break;
 			}
-			else redirect_index=1;
-		}
-		if (redirect_index != -1)
+			if (current->arg_count==arg_capacity)
+			{ // grow geometrically, the old array stays in the arena until reset
+				arg_capacity=arg_capacity?arg_capacity*2:8;
+				char **args=arena_alloc(&command_arena, sizeof(char *)*arg_capacity);
+				if (current->arg_count)
+					memcpy(args, current->args, sizeof(char *)*current->arg_count);
+				current->args=args;
+			}
+			current->args[current->arg_count++]=token.start;
+			break;
+		case TOKEN_IN:
+		case TOKEN_OUT:
+		case TOKEN_APPEND:
 		{
-			command->redirects[redirect_index]=malloc(len);
-			strcpy(command->redirects[redirect_index], arg+1);
-			continue;
+			int redirect_index=token.type==TOKEN_IN?0:token.type==TOKEN_OUT?1:2;
+			if (next_token(&lexer, &token)==-1 || token.type!=TOKEN_WORD)
+			{
+				error=redirect_index==0?"syntax error near `<'"
+					:redirect_index==1?"syntax error near `>'":"syntax error near `>>'";
+				break;
+			}
+			if (redirect_index!=0) // the last output redirection wins
+				current->redirects[1]=current->redirects[2]=NULL;
+			current->redirects[redirect_index]=token.start;
+			break;
+		}
+		case TOKEN_PIPE:
+			if (current->name==NULL)
+			{
+				error="syntax error near `|'";
+				break;
+			}
+			current->next=arena_calloc(&command_arena, sizeof(struct command_t));
+			current=current->next;
+			arg_capacity=0;
+			break;
+		case TOKEN_BACKGROUND:
+			command->background=true;
+			break;
+		case TOKEN_END:
+			break;
 		}
+	}
+	if (error==NULL && current->name==NULL && current!=command)
+		error="syntax error near `|'"; // pipe with nothing after it
+
+	if (error)
+	{
+		printf("-%s: %s\n", sysname, error);
+		memset(command, 0, sizeof(struct command_t));
+		command->name="";
+		return -1;
+	}
+	if (command->name==NULL) // empty line, or only redirections
+		command->name="";
+	if (command->args==NULL) // exec and the builtins expect an args array
+		command->args=arena_alloc(&command_arena, sizeof(char *));
+	for (struct command_t *c=command->next;c;c=c->next)
+		if (c->args==NULL)
+			c->args=arena_alloc(&command_arena, sizeof(char *));
+	return 0;
+}
+/**
+ * Hashed lookup of resolved executables (like the bash hash table).
+ * Entries are filled lazily the first time a command is run and are
+ * dropped when $PATH changes or the directory holding the binary is modified.
+ */
+#define EXEC_CACHE_SIZE 256
+struct exec_cache_entry {
+	char *name;
+	char *path; // resolved absolute path
+	size_t dir_len; // length of the directory part of path
+	struct timespec dir_mtime;
+	int hits;
+	struct exec_cache_entry *next;
+};
+static struct exec_cache_entry *exec_cache[EXEC_CACHE_SIZE];
+static char *exec_cache_path_env; // $PATH the cache was built against
 
-		// normal arguments
-		if (len>2 && ((arg[0]=='"' && arg[len-1]=='"')
-			|| (arg[0]=='\'' && arg[len-1]=='\''))) // quote wrapped arg
+static unsigned int exec_cache_hash(const char *name)
+{
+	unsigned int h=5381;
+	while (*name)
+		h=h*33+(unsigned char)*name++;
+	return h%EXEC_CACHE_SIZE;
+}
+/**
+ * Drop every entry of the executable cache
+ */
+void exec_cache_clear()
+{
+	for (int i=0;i<EXEC_CACHE_SIZE;++i)
+	{
+		struct exec_cache_entry *e=exec_cache[i], *n;
+		for (;e;e=n)
 		{
-			arg[--len]=0;
-			arg++;
+			n=e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
 		}
-		command->args=(char **)realloc(command->args, sizeof(char *)*(arg_index+1));
-		command->args[arg_index]=(char *)malloc(len+1);
-		strcpy(command->args[arg_index++], arg);
+		exec_cache[i]=NULL;
 	}
-	command->arg_count=arg_index;
+}
+/**
+ * Stat the directory part of a path
+ * @param  path    resolved executable path
+ * @param  dir_len length of its directory part
+ * @param  mtime   filled with the directory mtime
+ * @return         0 on success, -1 on error
+ */
+static int exec_cache_dir_mtime(const char *path, size_t dir_len, struct timespec *mtime)
+{
+	char dir[PATH_MAX];
+	struct stat st;
+	if (dir_len==0 || dir_len>=sizeof(dir)) return -1;
+	memcpy(dir, path, dir_len);
+	dir[dir_len]=0;
+	if (stat(dir, &st)==-1) return -1;
+	*mtime=st.st_mtim;
 	return 0;
 }
-void prompt_backspace()
+static bool is_executable_file(const char *path)
 {
-	putchar(8); // go back 1
-	putchar(' '); // write empty over
-	putchar(8); // go back 1 again
+	struct stat st;
+	return stat(path, &st)==0 && S_ISREG(st.st_mode) && (st.st_mode & 0111);
 }
 /**
- * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * Resolve a command name to an executable path using $PATH.
+ * The returned string is owned by the cache (or is name itself), do not free.
+ * @param  name command name
+ * @return      resolved path or NULL if not found
  */
-int prompt(struct command_t *command)
+const char *resolve_executable(const char *name)
 {
-	int index=0;
-	char c;
-	char buf[4096];
-	static char oldbuf[4096];
-
-    // tcgetattr gets the parameters of the current terminal
-    // STDIN_FILENO will tell tcgetattr that it should write the settings
-    // of stdin to oldt
-    static struct termios backup_termios, new_termios;
-    tcgetattr(STDIN_FILENO, &backup_termios);
-    new_termios = backup_termios;
-    // ICANON normally takes care that one line at a time will be processed
-    // that means it will return if it sees a "\n" or an EOF or an EOL
-    new_termios.c_lflag &= ~(ICANON | ECHO); // Also disable automatic echo. We manually echo each char.
-    // Those new settings will be set to STDIN
-    // TCSANOW tells tcsetattr to change attributes immediately.
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
-
-
-    //FIXME: backspace is applied before printing chars
-	show_prompt();
-	int multicode_state=0;
-	buf[0]=0;
-  	while (1)
-  	{
-		c=getchar();
-		// printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
-
-		if (c==9) // handle tab
-		{
-			buf[index++]='?'; // autocomplete
-			break;
-		}
+	if (strchr(name, '/')) // explicit path, no lookup
+		return is_executable_file(name)?name:NULL;
 
-		if (c==127) // handle backspace
-		{
-			if (index>0)
-			{
-				prompt_backspace();
-				index--;
-			}
-			continue;
-		}
-		if (c==27 && multicode_state==0) // handle multi-code keys
+	const char *path_env=getenv("PATH");
+	if (path_env==NULL) path_env="";
+	if (exec_cache_path_env==NULL || strcmp(exec_cache_path_env, path_env)!=0)
+	{ // $PATH changed, everything we know is stale
+		exec_cache_clear();
+		free(exec_cache_path_env);
+		exec_cache_path_env=strdup(path_env);
+	}
+
+	unsigned int h=exec_cache_hash(name);
+	struct exec_cache_entry **link=&exec_cache[h];
+	for (struct exec_cache_entry *e=*link;e;link=&e->next, e=*link)
+	{
+		if (strcmp(e->name, name)!=0) continue;
+		struct timespec mtime;
+		if (exec_cache_dir_mtime(e->path, e->dir_len, &mtime)==0
+			&& mtime.tv_sec==e->dir_mtime.tv_sec && mtime.tv_nsec==e->dir_mtime.tv_nsec)
 		{
-			multicode_state=1;
-			continue;
+			e->hits++;
+			return e->path;
 		}
-		if (c==91 && multicode_state==1)
+		// directory was modified, forget the entry and search again
+		*link=e->next;
+		free(e->name);
+		free(e->path);
+		free(e);
+		break;
+	}
+
+	char candidate[PATH_MAX];
+	size_t name_len=strlen(name);
+	const char *dir=path_env;
+	while (1)
+	{
+		const char *end=strchrnul(dir, ':');
+		size_t dir_len=end-dir;
+		if (dir_len==0) // empty entry means current directory
 		{
-			multicode_state=2;
-			continue;
+			dir=".";
+			dir_len=1;
 		}
-		if (c==65 && multicode_state==2) // up arrow
+		if (dir_len+1+name_len<sizeof(candidate))
 		{
-			int i;
-			while (index>0)
+			memcpy(candidate, dir, dir_len);
+			candidate[dir_len]='/';
+			memcpy(candidate+dir_len+1, name, name_len+1);
+			if (is_executable_file(candidate))
 			{
-				prompt_backspace();
-				index--;
+				if (candidate[0]!='/') // relative entries depend on cwd, don't cache
+				{
+					static char relative[PATH_MAX];
+					strcpy(relative, candidate);
+					return relative;
+				}
+				struct exec_cache_entry *e=malloc(sizeof(struct exec_cache_entry));
+				e->name=strdup(name);
+				e->path=strdup(candidate);
+				e->dir_len=dir_len;
+				if (exec_cache_dir_mtime(e->path, dir_len, &e->dir_mtime)==-1)
+					memset(&e->dir_mtime, 0, sizeof(e->dir_mtime));
+				e->hits=1;
+				e->next=exec_cache[h];
+				exec_cache[h]=e;
+				return e->path;
 			}
-			for (i=0;oldbuf[i];++i)
+		}
+		if (*end==0) break;
+		dir=end+1;
+	}
+	return NULL;
+}
+/**
+ * hash builtin: list, reset or prefill the executable cache
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_hash(struct command_t *command)
+{
+	if (command->arg_count==0)
+	{
+		bool empty=true;
+		for (int i=0;i<EXEC_CACHE_SIZE;++i)
+			for (struct exec_cache_entry *e=exec_cache[i];e;e=e->next)
 			{
-				putchar(oldbuf[i]);
-				buf[i]=oldbuf[i];
+				if (empty) printf("hits\tcommand\n");
+				empty=false;
+				printf("%4d\t%s\n", e->hits, e->path);
 			}
-			index=i;
+		if (empty)
+			printf("%s: hash table empty\n", sysname);
+		return SUCCESS;
+	}
+	for (int i=0;i<command->arg_count;++i)
+	{
+		if (strcmp(command->args[i], "-r")==0)
+		{
+			exec_cache_clear();
 			continue;
 		}
-		else
-			multicode_state=0;
-
-		putchar(c); // echo the character
-		buf[index++]=c;
-		if (index>=sizeof(buf)-1) break;
-		if (c=='\n') // enter key
-			break;
-		if (c==4) // Ctrl+D
-			return EXIT;
-  	}
-  	if (index>0 && buf[index-1]=='\n') // trim newline from the end
-  		index--;
-  	buf[index++]=0; // null terminate string
-
-  	strcpy(oldbuf, buf);
-
-  	parse_command(buf, command);
+		if (resolve_executable(command->args[i])==NULL)
+			printf("-%s: hash: %s: not found\n", sysname, command->args[i]);
+	}
+	return SUCCESS;
+}
+/**
+ * Description of an external program launch
+ */
+struct launch_t {
+	const char *path; // resolved executable path
+	char **argv; // NULL terminated, argv[0] is the command name
+	int fds[3]; // descriptors installed as stdin/stdout/stderr, -1 to inherit
+	pid_t pgid; // process group to join, 0 to lead a new one
+	// pipeline descriptors a forked builtin stage closes after the dup2s,
+	// as it never execs to drop the O_CLOEXEC ones
+	const int *close_fds;
+	int close_count;
+};
+/**
+ * Build an exec-ready argv (name, args..., NULL) for a command.
+ * Only the pointer array is allocated, the strings belong to the command.
+ * @param  command [description]
+ * @return         argv to be released with free()
+ */
+char **build_argv(struct command_t *command)
+{
+	char **argv=malloc(sizeof(char *)*(command->arg_count+2));
+	argv[0]=command->name;
+	for (int i=0;i<command->arg_count;++i)
+		argv[i+1]=command->args[i];
+	argv[command->arg_count+1]=NULL;
+	return argv;
+}
+/**
+ * Start an external program with posix_spawn, which avoids copying the
+ * shell's page tables the way fork() does.
+ * @param  launch [description]
+ * @return        child pid or -1 with errno set
+ */
+pid_t launch_process(struct launch_t *launch)
+{
+	extern char **environ;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t defaults;
+	pid_t pid;
 
-  	// print_command(command); // DEBUG: uncomment for debugging
+	posix_spawn_file_actions_init(&actions);
+	for (int i=0;i<3;++i)
+		if (launch->fds[i]!=-1)
+			posix_spawn_file_actions_adddup2(&actions, launch->fds[i], i);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setpgroup(&attr, launch->pgid);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGTTOU); // the shell ignores these, the child must not
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTSTP);
+	sigaddset(&defaults, SIGQUIT);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
 
-    // restore the old settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-  	return SUCCESS;
+	int r=posix_spawn(&pid, launch->path, &actions, &attr, launch->argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (r!=0)
+	{
+		errno=r;
+		return -1;
+	}
+	return pid;
 }
 int process_command(struct command_t *command);
 
-char cd[1000];//current file path
-FILE *fptr1 = NULL;
-FILE *fptr2 = NULL;
-FILE *fptr = NULL;
-FILE *fptr0 = NULL;
-int main()
+/**
+ * Job table. Every pipeline becomes a job keyed by its process group;
+ * SIGCHLD only pokes a self-pipe and children are reaped from the main
+ * loop with waitpid(WNOHANG), so background jobs never linger as zombies.
+ */
+struct stage_thread_t;
+struct process_t {
+	pid_t pid; // 0 for a stage running on a thread of the shell
+	char *name;
+	int status;
+	bool completed;
+	bool stopped;
+	struct rusage rusage; // filled by wait4 on exit
+	struct timespec finished;
+	struct stage_thread_t *thread;
+};
+/**
+ * A pipeline stage running on a thread of the shell instead of a forked
+ * child. It owns a copy of its command, as the arena is reset once the
+ * prompt comes back, and duplicates of its descriptors.
+ */
+struct stage_thread_t {
+	pthread_t id;
+	struct command_t command;
+	int (*run)(struct command_t *command, int in, int out);
+	int fds[2];
+	atomic_bool done;
+};
+struct job_t {
+	int id; // %n
+	pid_t pgid;
+	char *text; // command line shown by jobs
+	struct timespec started;
+	bool notified; // state change already reported
+	int process_count;
+	struct process_t *processes;
+	struct job_t *next;
+};
+static struct job_t *job_list;
+static int sigchld_pipe[2]={-1, -1};
+static bool interactive; // stdin is a terminal we can do job control on
+void terminal_restore();
+
+// ^C while a builtin runs in the shell process, which the signal can't
+// just kill: the long loops of builtins check this and give up
+static atomic_bool interrupted;
+static void sigint_handler(int sig)
 {
-	//save the current directory of the file 
-		getcwd(cd, sizeof(cd));
-		
-	//
-	while (1)
+	(void)sig;
+	atomic_store(&interrupted, true);
+}
+static void sigchld_handler(int sig)
+{
+	(void)sig;
+	int saved_errno=errno;
+	char c=0;
+	if (write(sigchld_pipe[1], &c, 1)==-1) {} // full pipe already means "reap"
+	errno=saved_errno;
+}
+/**
+ * Install the SIGCHLD self-pipe and the job control signal dispositions
+ */
+void jobs_init(bool interactive_shell)
+{
+	struct sigaction sa;
+	pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler=sigchld_handler;
+	sa.sa_flags=SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+	interactive=interactive_shell;
+	// needed to take the terminal back from foreground jobs
+	signal(SIGTTOU, SIG_IGN);
+	if (interactive)
 	{
-		struct command_t *command=malloc(sizeof(struct command_t));
-		memset(command, 0, sizeof(struct command_t)); // set all bytes to 0
-
-		int code;
-		code = prompt(command);
-		if (code==EXIT) break;
-
-		code = process_command(command);
-		if (code==EXIT) break;
-
-		free_command(command);
+		signal(SIGTSTP, SIG_IGN);
+		signal(SIGTTIN, SIG_IGN);
+		signal(SIGQUIT, SIG_IGN);
+		sa.sa_handler=sigint_handler;
+		sa.sa_flags=0; // a blocking read returns EINTR
+		sigaction(SIGINT, &sa, NULL);
 	}
-
-	printf("\n");
-	return 0;
 }
-
-int process_command(struct command_t *command)
+/**
+ * Render a command chain back to text for job listings
+ * @param  command [description]
+ * @return         malloc'ed string
+ */
+char *command_to_text(struct command_t *command)
 {
-	int r;
-	if (strcmp(command->name, "")==0) return SUCCESS;
-
-	if (strcmp(command->name, "exit")==0)
-		return EXIT;
-
-	if (strcmp(command->name, "cd")==0)
+	char *text=NULL;
+	size_t size=0;
+	FILE *f=open_memstream(&text, &size);
+	bool background=command->background;
+	for (;command;command=command->next)
 	{
-		if (command->arg_count > 0)
+		fputs(command->name, f);
+		for (int i=0;i<command->arg_count;++i)
+			fprintf(f, " %s", command->args[i]);
+		if (command->redirects[0]) fprintf(f, " < %s", command->redirects[0]);
+		if (command->redirects[1]) fprintf(f, " > %s", command->redirects[1]);
+		if (command->redirects[2]) fprintf(f, " >> %s", command->redirects[2]);
+		if (command->next) fputs(" | ", f);
+	}
+	if (background) fputs(" &", f);
+	fclose(f);
+	return text;
+}
+struct job_t *job_create(struct command_t *command)
+{
+	struct job_t *job=calloc(1, sizeof(struct job_t));
+	struct job_t **link=&job_list;
+	job->id=1;
+	for (;*link;link=&(*link)->next)
+		if ((*link)->id>=job->id)
+			job->id=(*link)->id+1;
+	job->text=command_to_text(command);
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	*link=job;
+	return job;
+}
+void job_add_process(struct job_t *job, pid_t pid, const char *name)
+{
+	job->processes=realloc(job->processes, sizeof(struct process_t)*(job->process_count+1));
+	memset(&job->processes[job->process_count], 0, sizeof(struct process_t));
+	job->processes[job->process_count].name=strdup(name);
+	job->processes[job->process_count++].pid=pid;
+	if (job->pgid==0) job->pgid=pid;
+}
+void job_free(struct job_t *job)
+{
+	for (struct job_t **link=&job_list;*link;link=&(*link)->next)
+		if (*link==job)
 		{
-			r=chdir(command->args[0]);
-			if (r==-1)
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-			return SUCCESS;
+			*link=job->next;
+			break;
 		}
+	for (int i=0;i<job->process_count;++i)
+		free(job->processes[i].name);
+	free(job->processes);
+	free(job->text);
+	free(job);
+}
+static bool job_is_completed(struct job_t *job)
+{
+	for (int i=0;i<job->process_count;++i)
+		if (!job->processes[i].completed)
+			return false;
+	return true;
+}
+static bool job_is_stopped(struct job_t *job)
+{
+	bool stopped=false;
+	for (int i=0;i<job->process_count;++i)
+	{
+		if (job->processes[i].thread) continue; // can't be stopped, blocks on its input instead
+		if (!job->processes[i].completed && !job->processes[i].stopped)
+			return false;
+		stopped|=job->processes[i].stopped;
 	}
-	
-	//baca command. Question 6 implementation
-	if (strcmp(command->name, "baca")==0)
-	//BaCa stands for Batu, Can. 
-	//requires python3 being available in the terminal
-	{
-		if (command->arg_count == 0){
-			pid_t pid=fork();
-			if (pid==0){//execvp called in fork() to prevent parent from terminating the seashell
-				//resolve python script path 
-				char * bacaPath = malloc(sizeof(char) * 50);
-				strcpy(bacaPath, cd);
-				strcpy(bacaPath, "chimneyAnimation.py");
-				char * arr[] = {"python3",bacaPath, NULL};
-				execvp("python3", arr);
-				free(bacaPath);
-			}else{//parent
-				wait(0);
-				return SUCCESS;
-			} 
+	return stopped;
+}
+/**
+ * Record a status reported by wait4 in the owning job
+ * @param pid    [description]
+ * @param status [description]
+ * @param rusage resources used by the process if it exited
+ */
+static void job_update(pid_t pid, int status, struct rusage *rusage)
+{
+	for (struct job_t *job=job_list;job;job=job->next)
+		for (int i=0;i<job->process_count;++i)
+		{
+			struct process_t *p=&job->processes[i];
+			if (p->pid!=pid) continue;
+			p->status=status;
+			if (WIFSTOPPED(status))
+				p->stopped=true;
+			else if (WIFCONTINUED(status))
+				p->stopped=false;
+			else
+			{
+				p->completed=true;
+				p->rusage=*rusage;
+				clock_gettime(CLOCK_MONOTONIC, &p->finished);
+			}
+			job->notified=false;
+			return;
 		}
-		
+}
+/**
+ * Join the thread stages of a job that have finished
+ * @param job   [description]
+ * @param block wait for the running ones as well
+ */
+static void job_join_threads(struct job_t *job, bool block)
+{
+	for (int i=0;i<job->process_count;++i)
+	{
+		struct process_t *p=&job->processes[i];
+		if (!p->thread || (!block && !atomic_load(&p->thread->done))) continue;
+		pthread_join(p->thread->id, NULL);
+		for (int j=0;j<p->thread->command.arg_count;++j)
+			free(p->thread->command.args[j]);
+		free(p->thread->command.args);
+		free(p->thread->command.name);
+		free(p->thread);
+		p->thread=NULL;
+		p->completed=true;
+		clock_gettime(CLOCK_MONOTONIC, &p->finished);
+		job->notified=false;
 	}
+}
+static bool job_has_children(struct job_t *job)
+{
+	for (int i=0;i<job->process_count;++i)
+		if (job->processes[i].pid && !job->processes[i].completed)
+			return true;
+	return false;
+}
+/**
+ * Reap every child that changed state without blocking
+ */
+void jobs_reap()
+{
+	char drain[64];
+	while (read(sigchld_pipe[0], drain, sizeof(drain))>0);
 
-	//kdiff command. implementation of Question5
-	if (strcmp(command->name, "kdiff")==0)
-	{
-		char * flagParam;
-		char * file1Param;
-		char * file2Param;
-		if (command->arg_count == 3){ //{-a,-b} file1 file2
-			//parse the input params
-			flagParam = malloc(sizeof(command->args[0]));
-			file1Param = malloc(sizeof(command->args[1]));
-			file2Param = malloc(sizeof(command->args[2]));
-			
-			flagParam = command->args[0]; //-b -a
-			file1Param = command->args[1]; //file1
-			file2Param = command->args[2]; //file2
-			
-		}else if(command->arg_count == 2){
-			//parse the input params
-			flagParam = malloc(sizeof(command->args[0]));
-			file1Param = malloc(sizeof(command->args[1]));
-			file2Param = malloc(sizeof(command->args[2]));
-				
-			flagParam = "-a"; //-b -a
-			file1Param = command->args[0]; //file1
-			file2Param = command->args[1]; //file2
-		}else{
-			printf("Invalid number of parameters supplied. Try again.");
-			return SUCCESS;
-		}
-			//check for the flagParam
-			if(strcmp(flagParam, "-a") == 0){
-				//check if file extensions are the same
-				char * file1Extension = malloc(sizeof(file1Param));
-				char * file2Extension = malloc(sizeof(file1Param));
-				bool file1Flag = 0;//0 for before . & 1 for after .
-				bool file2Flag = 0;//0 for before . & 1 for after .
-				int file1Count = 0;
-				int file2Count = 0;
-				
-				//get file extension for file1
-				for(int i = 0; i < strlen(file1Param); i++){
-					if(file1Flag == 1){
-						file1Extension[file1Count] = file1Param[i];
-						file1Count++;
-					}
-					if(file1Param[i] == '.'){
-						file1Flag = 1;
-					}
-				}
-				file1Count = 0;
-				file1Flag = 0;//0 for before . & 1 for after .
-				
-				
-
-				//get file extension for file1
-				for(int i = 0; i < strlen(file2Param); i++){
-					if(file2Flag == 1){
-						file2Extension[file2Count] = file2Param[i];
-						file2Count++;
-					}
-					if(file2Param[i] == '.'){
-						file2Flag = 1;
-					}
-				}
+	int status;
+	struct rusage rusage;
+	pid_t pid;
+	while ((pid=wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &rusage))>0)
+		job_update(pid, status, &rusage);
+	for (struct job_t *job=job_list;job;job=job->next)
+		job_join_threads(job, false);
+}
+static const char *job_state(struct job_t *job)
+{
+	if (job_is_completed(job)) return "Done";
+	if (job_is_stopped(job)) return "Stopped";
+	return "Running";
+}
+static void job_print(struct job_t *job)
+{
+	char current=job->next==NULL?'+':' '; // newest job is the default for fg/bg
+	printf("[%d]%c  %-24s%s\n", job->id, current, job_state(job), job->text);
+}
+/**
+ * Tell whether jobs_notify has anything to report
+ */
+bool jobs_have_news()
+{
+	for (struct job_t *job=job_list;job;job=job->next)
+		if (!job->notified && (job_is_completed(job) || job_is_stopped(job)))
+			return true;
+	return false;
+}
+/**
+ * Report background jobs that finished or stopped since the last prompt
+ */
+void jobs_notify()
+{
+	struct job_t *job=job_list, *next;
+	for (;job;job=next)
+	{
+		next=job->next;
+		if (job->notified) continue;
+		if (job_is_completed(job))
+		{
+			if (interactive) job_print(job);
+			job_free(job);
+		}
+		else if (job_is_stopped(job))
+		{
+			job_print(job);
+			job->notified=true;
+		}
+	}
+}
+/**
+ * Block until every process of a job has exited or the job is stopped
+ * @param job [description]
+ */
+void job_wait(struct job_t *job)
+{
+	while (!job_is_completed(job) && !job_is_stopped(job))
+	{
+		if (!job_has_children(job))
+		{ // only thread stages are left, they end when their input does
+			job_join_threads(job, true);
+			break;
+		}
+		int status;
+		struct rusage rusage;
+		pid_t pid=wait4(-job->pgid, &status, WUNTRACED, &rusage);
+		if (pid==-1)
+		{
+			if (errno==EINTR) continue;
+			for (int i=0;i<job->process_count;++i) // nothing left to wait for
+				if (job->processes[i].pid)
+					job->processes[i].completed=true;
+			continue;
+		}
+		job_update(pid, status, &rusage);
+	}
+}
+/**
+ * Run a job in the foreground, owning the terminal until it exits or stops
+ * @param  job  [description]
+ * @param  cont send SIGCONT first (fg of a stopped job)
+ * @return      true if the job completed, the caller then frees it
+ */
+bool job_foreground(struct job_t *job, bool cont)
+{
+	// a job of thread stages only has no process group: kill(0) would
+	// signal the shell's own group
+	bool grouped=job->pgid>0;
+	if (interactive && grouped)
+	{
+		terminal_restore(); // the job gets the terminal as the shell found it
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+	}
+	if (cont)
+	{
+		for (int i=0;i<job->process_count;++i)
+			job->processes[i].stopped=false;
+		if (grouped)
+			kill(-job->pgid, SIGCONT);
+	}
+	job_wait(job);
+	if (interactive && grouped)
+		tcsetpgrp(STDIN_FILENO, getpgrp());
+	if (job_is_completed(job))
+		return true;
+	printf("\n");
+	job_print(job);
+	job->notified=true;
+	return false;
+}
+/**
+ * Find a job from a %n / pid argument, or the newest job when spec is NULL
+ * @param  spec [description]
+ * @return      job or NULL
+ */
+struct job_t *job_find(const char *spec)
+{
+	struct job_t *job=job_list;
+	if (spec==NULL)
+	{
+		while (job && job->next) job=job->next;
+		return job;
+	}
+	if (spec[0]=='%')
+	{
+		int id=atoi(spec+1);
+		for (;job;job=job->next)
+			if (job->id==id) return job;
+		return NULL;
+	}
+	pid_t pid=atoi(spec);
+	if (pid<=0) return NULL; // thread stages have no pid
+	for (;job;job=job->next)
+		for (int i=0;i<job->process_count;++i)
+			if (job->processes[i].pid==pid) return job;
+	return NULL;
+}
+/**
+ * Builtin command registry entry
+ */
+struct builtin_t {
+	const char *name;
+	int (*handler)(struct command_t *command);
+	unsigned int flags;
+	const char *usage; // shown by help and on wrong arguments
+	// runs a pipeline stage reading from in on a thread instead of a fork
+	int (*stage)(struct command_t *command, int in, int out);
+};
+#define BUILTIN_PARENT 1 // needs the shell's own state, never forked
+#define BUILTIN_PIPELINE 2 // can be a pipeline stage
+#define BUILTIN_PREFIX 4 // takes the rest of the line, pipes included
+#define BUILTIN_SLOTS 32
+const struct builtin_t *find_builtin(const char *name);
+const struct builtin_t *builtin_slot(int slot);
+int builtin_help(struct command_t *command);
+int builtin_usage(struct command_t *command);
 
-				file2Count = 0;
-				file2Flag = 0;//0 for before . & 1 for after .
+/**
+ * Open the files named by a command's redirects
+ * @param  command [description]
+ * @param  fds     filled with the stdin/stdout descriptors to install, -1 if none
+ * @return         0 on success, -1 if a file could not be opened
+ */
+int open_redirects(struct command_t *command, int fds[2])
+{
+	fds[0]=fds[1]=-1;
+	if (command->redirects[0])
+	{
+		fds[0]=open(command->redirects[0], O_RDONLY | O_CLOEXEC);
+		if (fds[0]==-1)
+		{
+			printf("-%s: %s: %s\n", sysname, command->redirects[0], strerror(errno));
+			return -1;
+		}
+	}
+	const char *out=command->redirects[2]?command->redirects[2]:command->redirects[1];
+	if (out)
+	{
+		int flags=O_WRONLY | O_CREAT | O_CLOEXEC | (command->redirects[2]?O_APPEND:O_TRUNC);
+		fds[1]=open(out, flags, 0666);
+		if (fds[1]==-1)
+		{
+			printf("-%s: %s: %s\n", sysname, out, strerror(errno));
+			if (fds[0]!=-1) close(fds[0]);
+			fds[0]=-1;
+			return -1;
+		}
+	}
+	return 0;
+}
+static bool has_redirects(struct command_t *command)
+{
+	return command->redirects[0] || command->redirects[1] || command->redirects[2];
+}
+/**
+ * Run a builtin in the shell process with its redirects applied, by
+ * pointing stdin/stdout at the files for the duration of the builtin.
+ * @param  command [description]
+ * @return         the builtin's return code
+ */
+int run_redirected_builtin(struct command_t *command, const struct builtin_t *builtin)
+{
+	int fds[2], saved[2]={-1, -1};
+	if (open_redirects(command, fds)==-1)
+		return SUCCESS;
+	fflush(stdout);
+	for (int i=0;i<2;++i)
+		if (fds[i]!=-1)
+		{
+			saved[i]=fcntl(i, F_DUPFD_CLOEXEC, 10);
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
 
-				//check if extensions are the same
-				if(strcmp(file1Extension, file2Extension) != 0){//if extensions don't match
-					printf("Files are not text files.\n");
-					return SUCCESS;
-				}
+	int code=builtin->handler(command);
 
-				//open file1
-				//get current directory
-				char cwd[1000];
-				getcwd(cwd, sizeof(cwd));
-				//create path name to the text file
-				char * file1Path = malloc(sizeof(cwd) + sizeof(file1Param));
-				strcpy(file1Path, cwd);
-				strcat(file1Path, "/");
-				strcat(file1Path, file1Param);
-
-				fptr1 = NULL;
-				//file is open for both reading and appending & if file doesn't exists it is created
-				if(fptr1 == NULL){
-					char * file1Path = malloc(sizeof(cwd) + sizeof(file1Param));
-					strcpy(file1Path, cwd);
-					strcat(file1Path, "/");
-					strcat(file1Path, file1Param);
-					fptr1 = fopen(file1Path,"r"); 
-				}else{
-					fptr1 = freopen(file1Path,"r", fptr1); 
-				}
-				
-				
-				if(fptr1 == NULL){
-					printf("Error!");   
-				}
+	fflush(stdout);
+	for (int i=0;i<2;++i)
+		if (saved[i]!=-1)
+		{
+			dup2(saved[i], i);
+			close(saved[i]);
+		}
+	return code;
+}
+static pid_t start_stage(struct command_t *command, struct launch_t *launch)
+{
+	const struct builtin_t *builtin=find_builtin(command->name);
+	if (builtin)
+	{
+		fflush(NULL); // don't let the child inherit pending output
+		pid_t pid=fork();
+		if (pid==0)
+		{
+			signal(SIGTTOU, SIG_DFL);
+			signal(SIGTTIN, SIG_DFL);
+			signal(SIGTSTP, SIG_DFL);
+			signal(SIGQUIT, SIG_DFL);
+			signal(SIGINT, SIG_DFL);
+			setpgid(0, launch->pgid);
+			for (int i=0;i<3;++i)
+				if (launch->fds[i]!=-1)
+					dup2(launch->fds[i], i);
+			// a reader of our own output pipe would keep EPIPE from ever coming
+			for (int i=0;i<launch->close_count;++i)
+				if (launch->close_fds[i]>2)
+					close(launch->close_fds[i]);
+			int code=builtin->handler(command);
+			exit(code==UNKNOWN?127:0);
+		}
+		if (pid>0)
+			setpgid(pid, launch->pgid==0?pid:launch->pgid); // avoid racing the child
+		return pid;
+	}
 
-				//open file2
-				//create path name to the text file
-				char * file2Path = malloc(sizeof(cwd) + sizeof(file2Param));
-				strcpy(file2Path, cwd);
-				strcat(file2Path, "/");
-				strcat(file2Path, file2Param);
+	const char *exec_path=resolve_executable(command->name);
+	if (exec_path==NULL)
+	{
+		printf("-%s: %s: command not found\n", sysname, command->name);
+		return -1;
+	}
+	launch->path=exec_path;
+	launch->argv=build_argv(command);
+	pid_t pid=launch_process(launch);
+	free(launch->argv);
+	if (pid==-1)
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+	return pid;
+}
+static void *stage_thread_main(void *arg)
+{
+	struct stage_thread_t *thread=arg;
+	thread->run(&thread->command, thread->fds[0], thread->fds[1]);
+	close(thread->fds[0]);
+	close(thread->fds[1]);
+	atomic_store(&thread->done, true);
+	char c=0;
+	if (write(sigchld_pipe[1], &c, 1)==-1) {} // wake the main loop as an exiting child would
+	return NULL;
+}
+/**
+ * Start a builtin stage on a thread of the shell. All signals are blocked
+ * on it: job control signals go to the forked stages, and a closed output
+ * pipe gives EPIPE instead of killing the shell.
+ * @param  command [description]
+ * @param  builtin [description]
+ * @param  launch  fds[0] must be set
+ * @return         the thread, or NULL
+ */
+static struct stage_thread_t *start_stage_thread(struct command_t *command, const struct builtin_t *builtin,
+	struct launch_t *launch)
+{
+	struct stage_thread_t *thread=calloc(1, sizeof(struct stage_thread_t));
+	thread->command.name=strdup(command->name);
+	thread->command.arg_count=command->arg_count;
+	thread->command.args=malloc((command->arg_count+1)*sizeof(char *));
+	for (int i=0;i<command->arg_count;++i)
+		thread->command.args[i]=strdup(command->args[i]);
+	thread->command.args[command->arg_count]=NULL;
+	thread->run=builtin->stage;
+	thread->fds[0]=fcntl(launch->fds[0], F_DUPFD_CLOEXEC, 3);
+	thread->fds[1]=fcntl(launch->fds[1]!=-1?launch->fds[1]:STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
 
+	sigset_t all, saved;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &saved);
+	int error=thread->fds[0]==-1 || thread->fds[1]==-1 ? errno
+		: pthread_create(&thread->id, NULL, stage_thread_main, thread);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	if (error==0)
+		return thread;
+	printf("-%s: %s: %s\n", sysname, command->name, strerror(error));
+	for (int i=0;i<2;++i)
+		if (thread->fds[i]!=-1) close(thread->fds[i]);
+	for (int i=0;i<command->arg_count;++i)
+		free(thread->command.args[i]);
+	free(thread->command.args);
+	free(thread->command.name);
+	free(thread);
+	return NULL;
+}
+#define PIPELINE_PIPE_SIZE (1<<20) // pipe buffer for stages streaming bulk data
+/**
+ * Start a command and everything chained to it through command->next.
+ * All stages are started at once in a single process group connected by
+ * pipes and registered as a job. Builtins that can filter their input on
+ * a thread do so rather than fork, when they have an input to filter.
+ * @param  command first stage
+ * @return         the job, or NULL if no stage could be started
+ */
+struct job_t *start_pipeline(struct command_t *command)
+{
+	struct launch_t launch;
+	struct job_t *job=job_create(command);
+	int in_fd=-1;
 
-				fptr2 = NULL; 
-				//file is open for both reading and appending & if file doesn't exists it is created
-				
-				if(fptr2 == NULL){
-					char * file2Path = malloc(sizeof(cwd) + sizeof(file2Param));
-					strcpy(file2Path, cwd);
-					strcat(file2Path, "/");
-					strcat(file2Path, file2Param);
-					fptr2 = fopen(file2Path,"r"); 
-				}else{
-					fptr2 = freopen(file2Path,"r", fptr2); 
+	for (struct command_t *stage=command;stage;stage=stage->next)
+	{
+		int pipefd[2]={-1, -1};
+		if (stage->next)
+		{
+			if (pipe2(pipefd, O_CLOEXEC)==-1)
+			{
+				printf("-%s: %s: %s\n", sysname, stage->name, strerror(errno));
+				break;
+			}
+			fcntl(pipefd[1], F_SETPIPE_SZ, PIPELINE_PIPE_SIZE); // best effort, capped by pipe-max-size
+		}
+		int redirect_fds[2];
+		pid_t pid=-1;
+		const struct builtin_t *builtin=find_builtin(stage->name);
+		if (command->next && builtin && !(builtin->flags & BUILTIN_PIPELINE))
+			printf("-%s: %s: cannot be used in a pipeline\n", sysname, stage->name);
+		else if (open_redirects(stage, redirect_fds)==0)
+		{ // files take precedence over the pipe ends, as in sh
+			// everything the pipeline holds open, thread stages' copies included
+			int *open_fds=malloc((5+2*job->process_count)*sizeof(int)), open_count=0;
+			int own[5]={in_fd, pipefd[0], pipefd[1], redirect_fds[0], redirect_fds[1]};
+			for (int i=0;i<5;++i)
+				if (own[i]!=-1) open_fds[open_count++]=own[i];
+			for (int i=0;i<job->process_count;++i)
+				if (job->processes[i].thread)
+				{
+					open_fds[open_count++]=job->processes[i].thread->fds[0];
+					open_fds[open_count++]=job->processes[i].thread->fds[1];
 				}
-
-				
-				
-				if(fptr2 == NULL){
-					printf("Error!");   
+			memset(&launch, 0, sizeof(launch));
+			launch.fds[0]=redirect_fds[0]!=-1?redirect_fds[0]:in_fd;
+			launch.fds[1]=redirect_fds[1]!=-1?redirect_fds[1]:pipefd[1];
+			launch.fds[2]=-1;
+			launch.pgid=job->pgid;
+			launch.close_fds=open_fds;
+			launch.close_count=open_count;
+			if (builtin && builtin->stage && launch.fds[0]!=-1)
+			{
+				struct stage_thread_t *thread=start_stage_thread(stage, builtin, &launch);
+				if (thread)
+				{
+					job_add_process(job, 0, stage->name);
+					job->processes[job->process_count-1].thread=thread;
 				}
+			}
+			else
+				pid=start_stage(stage, &launch);
+			free(open_fds);
+			for (int i=0;i<2;++i)
+				if (redirect_fds[i]!=-1) close(redirect_fds[i]);
+		}
+		if (in_fd!=-1) close(in_fd);
+		if (pipefd[1]!=-1) close(pipefd[1]);
+		in_fd=pipefd[0];
+		if (pid>0)
+			job_add_process(job, pid, stage->name);
+	}
+	if (in_fd!=-1) close(in_fd);
+	if (job->process_count==0)
+	{
+		job_free(job);
+		return NULL;
+	}
+	return job;
+}
+/**
+ * Run a pipeline, waiting for it unless it is in the background
+ * @param  command first stage
+ * @return         SUCCESS
+ */
+int run_pipeline(struct command_t *command)
+{
+	struct job_t *job=start_pipeline(command);
+	if (job==NULL)
+		return SUCCESS;
+	if (command->background)
+	{
+		if (interactive && job->pgid>0)
+			printf("[%d] %d\n", job->id, job->pgid);
+		else if (interactive) // thread stages only
+			printf("[%d]\n", job->id);
+	}
+	else if (job_foreground(job, false))
+		job_free(job);
+	return SUCCESS;
+}
+/**
+ * Hardware counters for time -c, read through perf_event_open. The
+ * counters are opened on the shell with inherit set, so they also count
+ * every child started while they are enabled.
+ */
+#define PERF_COUNTER_COUNT 4
+static const struct {
+	const char *name;
+	unsigned long long config;
+} perf_counters[PERF_COUNTER_COUNT]={
+	{"cycles", PERF_COUNT_HW_CPU_CYCLES},
+	{"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+	{"cache-misses", PERF_COUNT_HW_CACHE_MISSES},
+	{"branch-misses", PERF_COUNT_HW_BRANCH_MISSES},
+};
+/**
+ * Open and start the hardware counters
+ * @param  fds filled with one descriptor per counter, -1 if unavailable
+ * @return     number of counters opened
+ */
+static int perf_counters_start(int fds[PERF_COUNTER_COUNT])
+{
+	int opened=0;
+	for (int i=0;i<PERF_COUNTER_COUNT;++i)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size=sizeof(attr);
+		attr.type=PERF_TYPE_HARDWARE;
+		attr.config=perf_counters[i].config;
+		attr.disabled=1;
+		attr.inherit=1;
+		attr.exclude_kernel=1;
+		attr.exclude_hv=1;
+		fds[i]=syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (fds[i]==-1) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		opened++;
+	}
+	return opened;
+}
+static void perf_counters_report(int fds[PERF_COUNTER_COUNT])
+{
+	for (int i=0;i<PERF_COUNTER_COUNT;++i)
+	{
+		unsigned long long value;
+		if (fds[i]==-1) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fds[i], &value, sizeof(value))==sizeof(value))
+			fprintf(stderr, "%16llu  %s\n", value, perf_counters[i].name);
+		close(fds[i]);
+	}
+}
+static double timespec_seconds(struct timespec *from, struct timespec *to)
+{
+	return (to->tv_sec-from->tv_sec)+(to->tv_nsec-from->tv_nsec)/1e9;
+}
+static double timeval_seconds(struct timeval *tv)
+{
+	return tv->tv_sec+tv->tv_usec/1e6;
+}
+static void time_report_line(const char *label, double real, struct rusage *ru)
+{
+	fprintf(stderr, "%-14s real %.3fs  user %.3fs  sys %.3fs  maxrss %ld KB  csw %ld/%ld\n",
+		label, real, timeval_seconds(&ru->ru_utime), timeval_seconds(&ru->ru_stime),
+		ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+/**
+ * time builtin: run the rest of the line and report wall/user/sys time,
+ * max RSS and voluntary/involuntary context switches, one line per stage
+ * for pipelines. -c adds hardware counters when perf events are available.
+ * Usage: time [-c] command...
+ * @param  command [description]
+ * @return         return code of the timed command
+ */
+int builtin_time(struct command_t *command)
+{
+	bool counters=command->arg_count>0 && strcmp(command->args[0], "-c")==0;
+	int shift=counters?1:0;
+	if (command->arg_count<=shift)
+	{
+		printf("-%s: time: usage: time [-c] command...\n", sysname);
+		return SUCCESS;
+	}
 
+	// turn "time [-c] cmd args" into "cmd args" for the duration of the run
+	char *name=command->name;
+	char **args=command->args;
+	int arg_count=command->arg_count;
+	command->name=args[shift];
+	command->args=args+shift+1;
+	command->arg_count=arg_count-shift-1;
 
-				char * line1 = NULL;
-				size_t len1 = 0;
-				ssize_t read1;
-
-				char * line2 = NULL;
-				size_t len2 = 0;
-				ssize_t read2;
-
-				read1 = getline(&line1, &len1, fptr1);
-				read2 = getline(&line2, &len2, fptr2); 
-				int diffLineCount = 0; //# number different lines btw file1 & file2
-				int lineNumber = 1; // keeps track of current line number
-				while ((read1  != -1) && (read2 != -1)) {
-					if(strcmp(line1, line2) != 0){
-						printf("%s : Line: %d : %s\n",file1Param, lineNumber, line1);
-						printf("%s : Line: %d : %s\n",file2Param, lineNumber, line2);
-						diffLineCount++;	
-					}
-					lineNumber++;
-					read1 = getline(&line1, &len1, fptr1);
-					read2 = getline(&line2, &len2, fptr2);
-				}
+	int perf_fds[PERF_COUNTER_COUNT];
+	if (counters && perf_counters_start(perf_fds)==0)
+		fprintf(stderr, "-%s: time: hardware counters unavailable: %s\n", sysname, strerror(errno));
 
-				if((read1  == -1) && (read2 == -1)){
-					if(diffLineCount == 0){
-						printf("The two files are identical\n");
-					}else{
-						printf("%d different lines found\n", diffLineCount);
-					}
-
-				}else{
-					if(read1 != -1){ // read1 has remaining lines
-						while(read1 != -1){//account for the remaining lines in file1
-							diffLineCount++;
-							read1 = getline(&line1, &len1, fptr1);
-						}
-						printf("%d different lines found\n", diffLineCount);
-					}else{// read2 has remaining lines
-						while(read2 != -1){//account for the remaining lines in file2
-							diffLineCount++;
-							read2 = getline(&line2, &len2, fptr2);
-						}
-						printf("%d different lines found\n", diffLineCount);
-					}
+	int code=SUCCESS;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (command->next==NULL && find_builtin(command->name))
+	{ // runs in this process, account for the shell itself
+		struct rusage before, after;
+		getrusage(RUSAGE_SELF, &before);
+		code=process_command(command);
+		getrusage(RUSAGE_SELF, &after);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+		timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+		after.ru_nvcsw-=before.ru_nvcsw;
+		after.ru_nivcsw-=before.ru_nivcsw;
+		time_report_line(command->name, timespec_seconds(&start, &end), &after);
+	}
+	else
+	{
+		bool background=command->background;
+		command->background=false; // timing needs the job in the foreground
+		struct job_t *job=start_pipeline(command);
+		command->background=background;
+		if (job && job_foreground(job, false))
+		{
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			struct rusage total;
+			memset(&total, 0, sizeof(total));
+			for (int i=0;i<job->process_count;++i)
+			{
+				struct process_t *p=&job->processes[i];
+				if (job->process_count>1)
+				{
+					char label[64];
+					snprintf(label, sizeof(label), "[%d] %s", i+1, p->name);
+					time_report_line(label, timespec_seconds(&job->started, &p->finished), &p->rusage);
 				}
+				timeradd(&total.ru_utime, &p->rusage.ru_utime, &total.ru_utime);
+				timeradd(&total.ru_stime, &p->rusage.ru_stime, &total.ru_stime);
+				if (p->rusage.ru_maxrss>total.ru_maxrss)
+					total.ru_maxrss=p->rusage.ru_maxrss;
+				total.ru_nvcsw+=p->rusage.ru_nvcsw;
+				total.ru_nivcsw+=p->rusage.ru_nivcsw;
+			}
+			time_report_line(job->process_count>1?"total":command->name,
+				timespec_seconds(&start, &end), &total);
+			job_free(job);
+		}
+	}
+	if (counters)
+		perf_counters_report(perf_fds);
 
-				rewind(fptr1);
-				rewind(fptr2);
+	command->name=name;
+	command->args=args;
+	command->arg_count=arg_count;
+	return code;
+}
+/**
+ * jobs builtin: list the job table
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_jobs(struct command_t *command)
+{
+	(void)command;
+	jobs_reap();
+	for (struct job_t *job=job_list, *next;job;job=next)
+	{
+		next=job->next;
+		job_print(job);
+		if (job_is_completed(job))
+			job_free(job);
+	}
+	return SUCCESS;
+}
+/**
+ * wait builtin: wait for one job (%n or pid) or for all of them
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_wait(struct command_t *command)
+{
+	if (command->arg_count==0)
+	{
+		while (job_list)
+		{
+			job_wait(job_list);
+			if (job_is_stopped(job_list)) break;
+			job_free(job_list);
+		}
+		return SUCCESS;
+	}
+	for (int i=0;i<command->arg_count;++i)
+	{
+		struct job_t *job=job_find(command->args[i]);
+		if (job==NULL)
+		{
+			printf("-%s: wait: %s: no such job\n", sysname, command->args[i]);
+			continue;
+		}
+		job_wait(job);
+		if (job_is_completed(job))
+			job_free(job);
+	}
+	return SUCCESS;
+}
+/**
+ * fg / bg builtins: continue a job in the foreground or the background
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_fg_bg(struct command_t *command)
+{
+	bool foreground=strcmp(command->name, "fg")==0;
+	struct job_t *job=job_find(command->arg_count>0?command->args[0]:NULL);
+	if (job==NULL)
+	{
+		printf("-%s: %s: %s: no such job\n", sysname, command->name,
+			command->arg_count>0?command->args[0]:"current");
+		return SUCCESS;
+	}
+	printf("%s\n", job->text);
+	if (foreground)
+	{
+		fflush(stdout);
+		if (job_foreground(job, true))
+			job_free(job);
+		return SUCCESS;
+	}
+	for (int i=0;i<job->process_count;++i)
+		job->processes[i].stopped=false;
+	job->notified=false;
+	if (job->pgid>0) // see job_foreground
+		kill(-job->pgid, SIGCONT);
+	return SUCCESS;
+}
 
-				fclose(fptr1);
-				fclose(fptr2);
+char cd[1000];//current file path
+/**
+ * Persistent command history, shared by all sessions through one
+ * append-only file. Every record is a single O_APPEND write framed as
+ * [u32 length][command][u32 length], so concurrent shells never interleave
+ * and the file can be walked from either end. The file is mmap'ed and is
+ * only scanned when a search first needs its trigram index, which is then
+ * extended with whatever was appended since.
+ */
+#define HISTORY_FILE ".seashell_history"
+#define HISTORY_BUCKETS 65536 // trigram hash buckets of the search index
+struct history_posting {
+	uint32_t *ids; // entries containing the trigram, oldest first
+	uint32_t count;
+	uint32_t capacity;
+};
+struct history_t {
+	int fd;
+	const char *map;
+	size_t map_size;
+	uint64_t *entries; // offset of each record, in file order
+	uint32_t entry_count;
+	uint32_t entry_capacity;
+	size_t indexed_size; // bytes of the file already in entries/buckets
+	struct history_posting *buckets;
+};
+static struct history_t history={.fd=-1};
 
-				free(file1Extension);
-				free(file2Extension);
-				free(file1Path);
-				free(file2Path);
-				
+/**
+ * Open the history file, in $HOME or else the startup directory
+ */
+void history_open()
+{
+	char path[PATH_MAX];
+	const char *home=getenv("HOME");
+	snprintf(path, sizeof(path), "%s/%s", home?home:cd, HISTORY_FILE);
+	history.fd=open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+}
+/**
+ * Make sure the mapping covers the whole file, other shells may have
+ * appended to it
+ */
+static void history_map()
+{
+	struct stat st;
+	if (history.fd==-1 || fstat(history.fd, &st)==-1 || (size_t)st.st_size==history.map_size)
+		return;
+	if (history.map)
+		munmap((void *)history.map, history.map_size);
+	history.map=NULL;
+	history.map_size=0;
+	if (st.st_size==0) return;
+	void *map=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, history.fd, 0);
+	if (map==MAP_FAILED) return;
+	history.map=map;
+	history.map_size=st.st_size;
+}
+static uint32_t history_u32(size_t offset)
+{
+	uint32_t value;
+	memcpy(&value, history.map+offset, sizeof(value));
+	return value;
+}
+/**
+ * Find the record that ends at a given offset
+ * @param  end     file offset just after the record
+ * @param  command filled with the command text (not NUL terminated)
+ * @param  len     filled with its length
+ * @return         offset of the record, or -1 if there is none
+ */
+static long history_record_before(size_t end, const char **command, uint32_t *len)
+{
+	if (end<8 || end>history.map_size) return -1;
+	uint32_t n=history_u32(end-4);
+	if (n>end-8 || history_u32(end-8-n)!=n) return -1; // damaged record
+	*command=history.map+end-4-n;
+	*len=n;
+	return end-8-n;
+}
+/**
+ * Append a command to the history file with one write
+ * @param line [description]
+ */
+void history_add(const char *line)
+{
+	uint32_t len=strlen(line);
+	if (history.fd==-1 || len==0) return;
 
-			}else if(strcmp(flagParam, "-b") == 0){
-				//open file1
-				FILE *fptr3;
-				//file is open for both reading and appending & if file doesn't exists it is created
-				
-				fptr3 = fopen(file1Param,"a+"); 
-				
-				if(fptr3 == NULL){
-					printf("Error!\n");   
-				}
+	history_map();
+	const char *last;
+	uint32_t last_len;
+	if (history_record_before(history.map_size, &last, &last_len)!=-1
+		&& last_len==len && memcmp(last, line, len)==0)
+		return; // same as the previous command
 
-				//open file2
-				FILE *fptr4;
-				//file is open for both reading and appending & if file doesn't exists it is created
-				
-				fptr4 = fopen(file2Param, "a+"); 
-				
-				if(fptr4 == NULL){
-					printf("Error!\n");   
-				}
+	char *record=malloc(len+8);
+	memcpy(record, &len, 4);
+	memcpy(record+4, line, len);
+	memcpy(record+4+len, &len, 4);
+	if (write(history.fd, record, len+8)==-1) {} // history is best effort
+	free(record);
+}
+static uint32_t trigram_bucket(const unsigned char *p)
+{
+	uint32_t key=(p[0]<<16) | (p[1]<<8) | p[2];
+	return (key*2654435761u)>>16 & (HISTORY_BUCKETS-1);
+}
+/**
+ * Bring the entry list and trigram index up to date with the file
+ */
+static void history_index()
+{
+	history_map();
+	if (history.buckets==NULL)
+		history.buckets=calloc(HISTORY_BUCKETS, sizeof(struct history_posting));
+	size_t offset=history.indexed_size;
+	while (offset+8<=history.map_size)
+	{
+		uint32_t len=history_u32(offset);
+		if (len>history.map_size-offset-8 || history_u32(offset+4+len)!=len)
+			break; // torn or damaged tail, stop here
+		if (history.entry_count==history.entry_capacity)
+		{
+			history.entry_capacity=history.entry_capacity?history.entry_capacity*2:1024;
+			history.entries=realloc(history.entries, sizeof(uint64_t)*history.entry_capacity);
+		}
+		uint32_t id=history.entry_count++;
+		history.entries[id]=offset;
 
-				//compare the binary files
-				int c1, c2;
-				int diffByteCount = 0;
-				c1 = getc(fptr3);
-				c2 = getc(fptr4);
-				while (c1 != EOF && c2 != EOF) {
-					if (c1 != c2 ){
-						diffByteCount++;
-					}
-					c1 = getc(fptr3);
-					c2 = getc(fptr4);
-				}
-				if (c1 == c2 && diffByteCount == 0) {// files are identical
-					printf("The two files are identical\n");
-
-				}else if(diffByteCount != 0){
-					printf("The two files are different in %d bytes\n", diffByteCount);
-				}else if(c1 != EOF){
-					while(c1 != EOF){
-						diffByteCount++;
-						c1 = getc(fptr3);
-					}
-					printf("The two files are different in %d bytes\n", diffByteCount);
-
-				}else if(c2 != EOF){
-					while(c2 != EOF){
-						diffByteCount++;
-						c2 = getc(fptr4);
-					}
-					printf("The two files are different in %d bytes\n", diffByteCount);
-				}
-				fclose(fptr3);
-				fclose(fptr4);
+		const unsigned char *command=(const unsigned char *)history.map+offset+4;
+		for (uint32_t i=0;i+3<=len;++i)
+		{
+			struct history_posting *posting=&history.buckets[trigram_bucket(command+i)];
+			if (posting->count && posting->ids[posting->count-1]==id)
+				continue; // trigram repeated within the entry
+			if (posting->count==posting->capacity)
+			{
+				posting->capacity=posting->capacity?posting->capacity*2:4;
+				posting->ids=realloc(posting->ids, sizeof(uint32_t)*posting->capacity);
 			}
-						
-			return SUCCESS;
-		
+			posting->ids[posting->count++]=id;
+		}
+		offset+=len+8;
+	}
+	history.indexed_size=offset;
+}
+static bool history_entry_matches(uint32_t id, const char *query, size_t query_len)
+{
+	uint64_t offset=history.entries[id];
+	uint32_t len=history_u32(offset);
+	return memmem(history.map+offset+4, len, query, query_len)!=NULL;
+}
+/**
+ * Find the newest entry older than before that contains query. Queries
+ * of three or more bytes only look at the entries listed under their
+ * rarest trigram.
+ * @param  query  [description]
+ * @param  before entry id to search below, UINT32_MAX for the newest
+ * @return        entry id or -1
+ */
+long history_search(const char *query, uint32_t before)
+{
+	size_t query_len=strlen(query);
+	history_index();
+	if (before>history.entry_count) before=history.entry_count;
+	if (query_len<3)
+	{
+		while (before-->0)
+			if (history_entry_matches(before, query, query_len))
+				return before;
+		return -1;
+	}
+
+	struct history_posting *rarest=NULL;
+	for (size_t i=0;i+3<=query_len;++i)
+	{
+		struct history_posting *posting=&history.buckets[trigram_bucket((const unsigned char *)query+i)];
+		if (rarest==NULL || posting->count<rarest->count)
+			rarest=posting;
 	}
+	// ids are ascending, find the first one >= before and walk down
+	uint32_t lo=0, hi=rarest->count;
+	while (lo<hi)
+	{
+		uint32_t mid=(lo+hi)/2;
+		if (rarest->ids[mid]<before) lo=mid+1;
+		else hi=mid;
+	}
+	while (lo-->0)
+		if (history_entry_matches(rarest->ids[lo], query, query_len))
+			return rarest->ids[lo];
+	return -1;
+}
+/**
+ * Text of an indexed entry
+ * @param  id  [description]
+ * @param  len filled with its length
+ * @return     command text, not NUL terminated
+ */
+const char *history_entry(uint32_t id, uint32_t *len)
+{
+	uint64_t offset=history.entries[id];
+	*len=history_u32(offset);
+	return history.map+offset+4;
+}
+/**
+ * history builtin: print the last n commands (all by default)
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_history(struct command_t *command)
+{
+	history_index();
+	uint32_t count=history.entry_count;
+	if (command->arg_count>0)
+	{
+		long n=atol(command->args[0]);
+		if (n>=0 && (uint32_t)n<count) count=n;
+	}
+	for (uint32_t id=history.entry_count-count;id<history.entry_count;++id)
+	{
+		uint32_t len;
+		const char *text=history_entry(id, &len);
+		printf("%5u  %.*s\n", id+1, (int)len, text);
+	}
+	return SUCCESS;
+}
+/**
+ * shortdir store. The "alias$dir" lines of chdirMem.txt are loaded once
+ * into a hash table, so set, jump and del cost O(1) however many aliases
+ * there are. Changes are written to a temporary file that is renamed
+ * over chdirMem.txt, so no reader ever sees half a file. A file replaced
+ * by another shell, or by a forked pipeline stage, is noticed with one
+ * stat and loaded again.
+ */
+#define SHORTDIR_FILE "chdirMem.txt"
+#define SHORTDIR_DELETED UINT32_MAX // index slot of a deleted alias
+struct shortdir_entry {
+	char *alias; // NULL once deleted
+	char *dir;
+};
+static struct {
+	bool loaded;
+	struct stat st; // of the file loaded, zeroed if there was none
+	struct shortdir_entry *entries; // in file order, deleted ones included
+	size_t count;
+	size_t capacity;
+	size_t live;
+	uint32_t *index; // open addressing: entry+1, 0 for empty
+	size_t index_size;
+} shortdir;
+
+static uint64_t shortdir_hash(const char *alias)
+{
+	uint64_t h=0xcbf29ce484222325ULL; // FNV-1a
+	for (;*alias;++alias)
+		h=(h ^ (unsigned char)*alias)*0x100000001b3ULL;
+	return h;
+}
+/**
+ * Find the index slot of an alias
+ * @param  alias [description]
+ * @param  found set if the alias is there
+ * @return       its slot, or else the slot to insert it at
+ */
+static size_t shortdir_probe(const char *alias, bool *found)
+{
+	size_t mask=shortdir.index_size-1, slot=shortdir_hash(alias) & mask, reuse=SIZE_MAX;
+	for (;shortdir.index[slot];slot=(slot+1) & mask)
+	{
+		uint32_t entry=shortdir.index[slot];
+		if (entry==SHORTDIR_DELETED)
+		{
+			if (reuse==SIZE_MAX) reuse=slot;
+		}
+		else if (strcmp(shortdir.entries[entry-1].alias, alias)==0)
+		{
+			*found=true;
+			return slot;
+		}
+	}
+	*found=false;
+	return reuse!=SIZE_MAX ? reuse : slot;
+}
+/**
+ * Drop deleted entries and index the rest into a table at most a quarter
+ * full, which leaves room for as many inserts again before the next one
+ */
+static void shortdir_rebuild()
+{
+	size_t live=0;
+	for (size_t i=0;i<shortdir.count;++i)
+		if (shortdir.entries[i].alias)
+			shortdir.entries[live++]=shortdir.entries[i];
+	shortdir.count=shortdir.live=live;
+	shortdir.index_size=16;
+	while (shortdir.index_size<4*live) shortdir.index_size*=2;
+	free(shortdir.index);
+	shortdir.index=calloc(shortdir.index_size, sizeof(uint32_t));
+	for (size_t i=0;i<live;++i)
+	{
+		bool found;
+		shortdir.index[shortdir_probe(shortdir.entries[i].alias, &found)]=i+1;
+	}
+}
+static struct shortdir_entry *shortdir_find(const char *alias)
+{
+	bool found;
+	size_t slot=shortdir_probe(alias, &found);
+	return found ? &shortdir.entries[shortdir.index[slot]-1] : NULL;
+}
+/**
+ * Point an alias at a directory, replacing what it pointed at before
+ * @param alias [description]
+ * @param dir   [description]
+ */
+static void shortdir_put(const char *alias, const char *dir)
+{
+	struct shortdir_entry *entry=shortdir_find(alias);
+	if (entry)
+	{
+		free(entry->dir);
+		entry->dir=strdup(dir);
+		return;
+	}
+	if (2*(shortdir.count+1)>shortdir.index_size) // deleted entries hold slots too
+		shortdir_rebuild();
+	if (shortdir.count==shortdir.capacity)
+	{
+		shortdir.capacity=shortdir.capacity ? 2*shortdir.capacity : 16;
+		shortdir.entries=realloc(shortdir.entries, shortdir.capacity*sizeof(struct shortdir_entry));
+	}
+	bool found;
+	shortdir.index[shortdir_probe(alias, &found)]=shortdir.count+1;
+	shortdir.entries[shortdir.count++]=(struct shortdir_entry){strdup(alias), strdup(dir)};
+	shortdir.live++;
+}
+/**
+ * Remove an alias
+ * @return false if there was no such alias
+ */
+static bool shortdir_del(const char *alias)
+{
+	bool found;
+	size_t slot=shortdir_probe(alias, &found);
+	if (!found) return false;
+	struct shortdir_entry *entry=&shortdir.entries[shortdir.index[slot]-1];
+	free(entry->alias);
+	free(entry->dir);
+	entry->alias=entry->dir=NULL;
+	shortdir.index[slot]=SHORTDIR_DELETED;
+	shortdir.live--;
+	return true;
+}
+static void shortdir_clear()
+{
+	for (size_t i=0;i<shortdir.count;++i)
+	{
+		free(shortdir.entries[i].alias);
+		free(shortdir.entries[i].dir);
+	}
+	shortdir.count=0;
+	shortdir_rebuild();
+}
+static bool shortdir_same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev==b->st_dev && a->st_ino==b->st_ino && a->st_size==b->st_size
+		&& a->st_mtim.tv_sec==b->st_mtim.tv_sec && a->st_mtim.tv_nsec==b->st_mtim.tv_nsec;
+}
+/**
+ * Load chdirMem.txt unless the copy in memory is still current. Lines
+ * without an alias and a directory are skipped; of repeated aliases, left
+ * by versions that appended blindly, the last one wins.
+ */
+static void shortdir_load()
+{
+	char path[sizeof(cd)+sizeof(SHORTDIR_FILE)+1];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s/%s", cd, SHORTDIR_FILE);
+	FILE *file=fopen(path, "r");
+	if (file==NULL || fstat(fileno(file), &st)==-1)
+		memset(&st, 0, sizeof(st));
+	if (shortdir.loaded && shortdir_same_file(&st, &shortdir.st))
+	{
+		if (file) fclose(file);
+		return;
+	}
+	shortdir_clear();
+	shortdir.loaded=true;
+	shortdir.st=st;
+	if (file==NULL) return;
+	char *line=NULL;
+	size_t capacity=0;
+	ssize_t len;
+	while ((len=getline(&line, &capacity, file))!=-1)
+	{
+		if (len>0 && line[len-1]=='\n') line[--len]=0;
+		char *dir=strchr(line, '$');
+		if (dir==NULL || dir==line || dir[1]==0) continue;
+		*dir++=0;
+		shortdir_put(line, dir);
+	}
+	free(line);
+	fclose(file);
+}
+/**
+ * Write the aliases back: to a temporary file first, then renamed over
+ * chdirMem.txt
+ * @param  command for error messages
+ * @return         0, or -1 after printing an error
+ */
+static int shortdir_save(struct command_t *command)
+{
+	char path[sizeof(cd)+sizeof(SHORTDIR_FILE)+1], temp[sizeof(path)+8];
+	snprintf(path, sizeof(path), "%s/%s", cd, SHORTDIR_FILE);
+	snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+	int fd=mkostemp(temp, O_CLOEXEC);
+	FILE *file=fd==-1 ? NULL : fdopen(fd, "w");
+	if (file==NULL)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, fd==-1 ? temp : path, strerror(errno));
+		if (fd!=-1)
+		{
+			close(fd);
+			unlink(temp);
+		}
+		return -1;
+	}
+	for (size_t i=0;i<shortdir.count;++i)
+		if (shortdir.entries[i].alias)
+			fprintf(file, "%s$%s\n", shortdir.entries[i].alias, shortdir.entries[i].dir);
+	bool failed=fflush(file)==EOF || fsync(fd)==-1;
+	mode_t mask=umask(0); // mkstemp makes it 0600, fopen gave 0666 less the umask
+	umask(mask);
+	fchmod(fd, 0666 & ~mask);
+	if (fclose(file)==EOF || failed || rename(temp, path)==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path, strerror(errno));
+		unlink(temp);
+		return -1;
+	}
+	if (stat(path, &shortdir.st)==-1)
+		memset(&shortdir.st, 0, sizeof(shortdir.st));
+	return 0;
+}
+/**
+ * Tab completion. Command names come from one prefix trie per $PATH
+ * directory, rebuilt only when that directory's mtime changes, so a warm
+ * Tab costs one stat per directory plus a walk below the typed prefix.
+ * File names come from sorted directory listings cached per directory and
+ * revalidated the same way.
+ */
+enum completion_kind {
+	COMPLETE_COMMAND,
+	COMPLETE_FILE,
+	COMPLETE_SHORTDIR,
+};
+struct trie_node {
+	unsigned char c;
+	bool terminal; // a name ends here
+	int child; // first child, 0 for none (the root is never a child)
+	int sibling; // next sibling, siblings are sorted by c
+};
+struct trie_t {
+	struct trie_node *nodes;
+	int count;
+	int capacity;
+};
+struct path_dir_t {
+	char *path;
+	struct timespec mtime;
+	bool scanned;
+	struct trie_t trie;
+};
+static struct path_dir_t *path_dirs;
+static int path_dir_count;
+static char *path_dirs_env; // $PATH the directory list was built for
+
+#define DIR_CACHE_SIZE 16
+struct dir_cache_entry {
+	char *path; // absolute directory path
+	struct timespec mtime;
+	char *names; // NUL separated, directories end with '/'
+	char **sorted;
+	int count;
+	unsigned long used; // clock of the last lookup, for eviction
+};
+static struct dir_cache_entry dir_cache[DIR_CACHE_SIZE];
+static unsigned long dir_cache_clock;
+
+// candidates of the last completion, sorted and unique
+struct completion_list {
+	char *pool;
+	size_t pool_len;
+	size_t pool_capacity;
+	size_t *offsets;
+	char **items;
+	int count;
+	int capacity;
+};
+static struct completion_list completions;
+
+static int trie_new_node(struct trie_t *trie, unsigned char c)
+{
+	if (trie->count==trie->capacity)
+	{
+		trie->capacity=trie->capacity?trie->capacity*2:256;
+		trie->nodes=realloc(trie->nodes, trie->capacity*sizeof(struct trie_node));
+	}
+	struct trie_node *node=&trie->nodes[trie->count];
+	node->c=c;
+	node->terminal=false;
+	node->child=node->sibling=0;
+	return trie->count++;
+}
+static void trie_insert(struct trie_t *trie, const char *name)
+{
+	if (trie->count==0)
+		trie_new_node(trie, 0); // root
+	int node=0;
+	for (const unsigned char *p=(const unsigned char *)name;*p;++p)
+	{
+		int prev=0, next=trie->nodes[node].child;
+		while (next && trie->nodes[next].c<*p)
+		{
+			prev=next;
+			next=trie->nodes[next].sibling;
+		}
+		if (next==0 || trie->nodes[next].c!=*p)
+		{ // indices, not pointers: the node array may move
+			int n=trie_new_node(trie, *p);
+			trie->nodes[n].sibling=next;
+			if (prev) trie->nodes[prev].sibling=n;
+			else trie->nodes[node].child=n;
+			next=n;
+		}
+		node=next;
+	}
+	trie->nodes[node].terminal=true;
+}
+/**
+ * Find the node reached by a prefix
+ * @return node index, or -1 if no name starts with prefix
+ */
+static int trie_find(const struct trie_t *trie, const char *prefix, size_t len)
+{
+	if (trie->count==0) return -1;
+	int node=0;
+	for (size_t i=0;i<len;++i)
+	{
+		int next=trie->nodes[node].child;
+		while (next && trie->nodes[next].c<(unsigned char)prefix[i])
+			next=trie->nodes[next].sibling;
+		if (next==0 || trie->nodes[next].c!=(unsigned char)prefix[i])
+			return -1;
+		node=next;
+	}
+	return node;
+}
+
+static void completion_add(const char *prefix, size_t prefix_len, const char *name, size_t name_len, bool dir)
+{
+	size_t need=prefix_len+name_len+2;
+	if (completions.pool_len+need>completions.pool_capacity)
+	{
+		completions.pool_capacity=(completions.pool_len+need)*2;
+		completions.pool=realloc(completions.pool, completions.pool_capacity);
+	}
+	if (completions.count==completions.capacity)
+	{
+		completions.capacity=completions.capacity?completions.capacity*2:64;
+		completions.offsets=realloc(completions.offsets, completions.capacity*sizeof(size_t));
+		completions.items=realloc(completions.items, completions.capacity*sizeof(char *));
+	}
+	char *p=completions.pool+completions.pool_len;
+	completions.offsets[completions.count++]=completions.pool_len;
+	memcpy(p, prefix, prefix_len);
+	memcpy(p+prefix_len, name, name_len);
+	p+=prefix_len+name_len;
+	if (dir) *p++='/';
+	*p++=0;
+	completions.pool_len=p-completions.pool;
+}
+static void trie_collect(const struct trie_t *trie, int node, char *name, size_t depth)
+{
+	for (int child=trie->nodes[node].child;child;child=trie->nodes[child].sibling)
+	{
+		if (depth+1>=NAME_MAX) continue;
+		name[depth]=trie->nodes[child].c;
+		if (trie->nodes[child].terminal)
+			completion_add("", 0, name, depth+1, false);
+		trie_collect(trie, child, name, depth+1);
+	}
+}
+/**
+ * Rebuild the trie of one $PATH directory
+ * @param dir [description]
+ */
+static void path_dir_scan(struct path_dir_t *dir)
+{
+	dir->trie.count=0;
+	DIR *d=opendir(dir->path);
+	if (d==NULL) return;
+	struct dirent *entry;
+	struct stat st;
+	while ((entry=readdir(d))!=NULL)
+	{
+		if (entry->d_name[0]=='.') continue;
+		if (entry->d_type!=DT_REG && entry->d_type!=DT_LNK && entry->d_type!=DT_UNKNOWN)
+			continue;
+		if (fstatat(dirfd(d), entry->d_name, &st, 0)==0 && S_ISREG(st.st_mode) && (st.st_mode & 0111))
+			trie_insert(&dir->trie, entry->d_name);
+	}
+	closedir(d);
+}
+/**
+ * Bring the $PATH tries up to date: the directory list follows $PATH and
+ * only directories whose mtime moved are scanned again. Relative entries
+ * depend on the cwd and are left to file completion.
+ */
+static void path_dirs_refresh()
+{
+	const char *path_env=getenv("PATH");
+	if (path_env==NULL) path_env="";
+	if (path_dirs_env==NULL || strcmp(path_dirs_env, path_env)!=0)
+	{
+		for (int i=0;i<path_dir_count;++i)
+		{
+			free(path_dirs[i].path);
+			free(path_dirs[i].trie.nodes);
+		}
+		free(path_dirs);
+		path_dirs=NULL;
+		path_dir_count=0;
+		for (const char *dir=path_env;;)
+		{
+			const char *end=strchrnul(dir, ':');
+			if (dir[0]=='/')
+			{
+				path_dirs=realloc(path_dirs, (path_dir_count+1)*sizeof(struct path_dir_t));
+				memset(&path_dirs[path_dir_count], 0, sizeof(struct path_dir_t));
+				path_dirs[path_dir_count++].path=strndup(dir, end-dir);
+			}
+			if (*end==0) break;
+			dir=end+1;
+		}
+		free(path_dirs_env);
+		path_dirs_env=strdup(path_env);
+	}
+	for (int i=0;i<path_dir_count;++i)
+	{
+		struct path_dir_t *dir=&path_dirs[i];
+		struct stat st;
+		if (stat(dir->path, &st)==-1)
+		{
+			dir->trie.count=0;
+			dir->scanned=false;
+			continue;
+		}
+		if (dir->scanned && st.st_mtim.tv_sec==dir->mtime.tv_sec && st.st_mtim.tv_nsec==dir->mtime.tv_nsec)
+			continue;
+		// mtime is taken before the scan so a change during it is seen next time
+		path_dir_scan(dir);
+		dir->mtime=st.st_mtim;
+		dir->scanned=true;
+	}
+}
+static int string_compare(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+/**
+ * Sorted listing of a directory, served from the cache while the
+ * directory's mtime is unchanged
+ * @param  path absolute directory path
+ * @return      cache entry, or NULL if the directory can't be read
+ */
+static struct dir_cache_entry *dir_cache_get(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st)==-1 || !S_ISDIR(st.st_mode)) return NULL;
+
+	struct dir_cache_entry *entry=NULL, *victim=&dir_cache[0];
+	for (int i=0;i<DIR_CACHE_SIZE;++i)
+	{
+		if (dir_cache[i].path && strcmp(dir_cache[i].path, path)==0)
+		{
+			entry=&dir_cache[i];
+			break;
+		}
+		if (victim->path && (dir_cache[i].path==NULL || dir_cache[i].used<victim->used))
+			victim=&dir_cache[i];
+	}
+	if (entry && st.st_mtim.tv_sec==entry->mtime.tv_sec && st.st_mtim.tv_nsec==entry->mtime.tv_nsec)
+	{
+		entry->used=++dir_cache_clock;
+		return entry;
+	}
+	if (entry==NULL)
+	{
+		entry=victim;
+		free(entry->path);
+		entry->path=strdup(path);
+	}
+	DIR *d=opendir(path);
+	if (d==NULL)
+	{
+		free(entry->path);
+		entry->path=NULL;
+		return NULL;
+	}
+	size_t len=0, capacity=4096;
+	char *names=malloc(capacity);
+	int count=0;
+	struct dirent *e;
+	while ((e=readdir(d))!=NULL)
+	{
+		if (strcmp(e->d_name, ".")==0 || strcmp(e->d_name, "..")==0) continue;
+		bool is_dir=e->d_type==DT_DIR;
+		if (e->d_type==DT_LNK || e->d_type==DT_UNKNOWN)
+		{
+			struct stat target;
+			is_dir=fstatat(dirfd(d), e->d_name, &target, 0)==0 && S_ISDIR(target.st_mode);
+		}
+		size_t name_len=strlen(e->d_name);
+		if (len+name_len+2>capacity)
+		{
+			capacity=(len+name_len+2)*2;
+			names=realloc(names, capacity);
+		}
+		memcpy(names+len, e->d_name, name_len);
+		len+=name_len;
+		if (is_dir) names[len++]='/';
+		names[len++]=0;
+		count++;
+	}
+	closedir(d);
+
+	free(entry->names);
+	free(entry->sorted);
+	entry->names=names;
+	entry->count=count;
+	entry->sorted=malloc((count?count:1)*sizeof(char *));
+	for (int i=0;i<count;++i, names+=strlen(names)+1)
+		entry->sorted[i]=names;
+	qsort(entry->sorted, count, sizeof(char *), string_compare);
+	entry->mtime=st.st_mtim;
+	entry->used=++dir_cache_clock;
+	return entry;
+}
+static void complete_command(const char *word, size_t len)
+{
+	for (int i=0;i<BUILTIN_SLOTS;++i)
+	{
+		const struct builtin_t *builtin=builtin_slot(i);
+		if (builtin && strncmp(builtin->name, word, len)==0)
+			completion_add("", 0, builtin->name, strlen(builtin->name), false);
+	}
+	path_dirs_refresh();
+	char name[NAME_MAX+1];
+	memcpy(name, word, len<NAME_MAX?len:NAME_MAX);
+	for (int i=0;i<path_dir_count;++i)
+	{
+		const struct trie_t *trie=&path_dirs[i].trie;
+		int node=trie_find(trie, word, len);
+		if (node==-1) continue;
+		if (len>0 && trie->nodes[node].terminal)
+			completion_add("", 0, word, len, false);
+		if (len<NAME_MAX)
+			trie_collect(trie, node, name, len);
+	}
+}
+static void complete_file(const char *word, size_t len)
+{
+	const char *slash=memrchr(word, '/', len);
+	size_t dir_len=slash?(size_t)(slash-word)+1:0;
+	const char *base=word+dir_len;
+	size_t base_len=len-dir_len;
+
+	char path[PATH_MAX];
+	int n;
+	if (dir_len>0 && word[0]=='/')
+		n=snprintf(path, sizeof(path), "%.*s", (int)dir_len, word);
+	else if (dir_len>0 && word[0]=='~' && word[1]=='/')
+		n=snprintf(path, sizeof(path), "%s%.*s", getenv("HOME")?getenv("HOME"):"", (int)dir_len-1, word+1);
+	else
+	{
+		char cwd[PATH_MAX];
+		if (getcwd(cwd, sizeof(cwd))==NULL) return;
+		n=snprintf(path, sizeof(path), "%s/%.*s", cwd, (int)dir_len, word);
+	}
+	if (n<0 || (size_t)n>=sizeof(path)) return;
+
+	struct dir_cache_entry *entry=dir_cache_get(path);
+	if (entry==NULL) return;
+	// first name not sorting before the prefix
+	int lo=0, hi=entry->count;
+	while (lo<hi)
+	{
+		int mid=(lo+hi)/2;
+		if (strncmp(entry->sorted[mid], base, base_len)<0) lo=mid+1;
+		else hi=mid;
+	}
+	for (int i=lo;i<entry->count && strncmp(entry->sorted[i], base, base_len)==0;++i)
+	{
+		const char *name=entry->sorted[i];
+		if (name[0]=='.' && (base_len==0 || base[0]!='.')) continue; // hidden
+		completion_add(word, dir_len, name, strlen(name), false);
+	}
+}
+static void complete_shortdir(const char *word, size_t len)
+{
+	shortdir_load();
+	for (size_t i=0;i<shortdir.count;++i)
+	{
+		const char *alias=shortdir.entries[i].alias;
+		if (alias && strncmp(alias, word, len)==0)
+			completion_add("", 0, alias, strlen(alias), false);
+	}
+}
+/**
+ * Collect the completions of a word into the completion list
+ * @param  kind what the word is
+ * @param  word unescaped word, not NUL terminated
+ * @param  len  its length
+ * @return      number of candidates
+ */
+int complete(enum completion_kind kind, const char *word, size_t len)
+{
+	completions.count=0;
+	completions.pool_len=0;
+	if (kind==COMPLETE_COMMAND && memchr(word, '/', len)==NULL)
+		complete_command(word, len);
+	else if (kind==COMPLETE_SHORTDIR)
+		complete_shortdir(word, len);
+	else
+		complete_file(word, len);
+
+	for (int i=0;i<completions.count;++i)
+		completions.items[i]=completions.pool+completions.offsets[i];
+	qsort(completions.items, completions.count, sizeof(char *), string_compare);
+	int unique=0;
+	for (int i=0;i<completions.count;++i)
+		if (unique==0 || strcmp(completions.items[unique-1], completions.items[i])!=0)
+			completions.items[unique++]=completions.items[i];
+	completions.count=unique;
+	return unique;
+}
+/**
+ * Work out what the word starting at start is from the text before it
+ * @param  line [description]
+ * @param  start offset of the word
+ * @return      completion kind
+ */
+enum completion_kind completion_kind_at(const char *line, size_t start)
+{
+	size_t i=start;
+	while (i>0 && (line[i-1]==' ' || line[i-1]=='\t')) i--;
+	if (i==0 || line[i-1]=='|')
+		return COMPLETE_COMMAND;
+	// shortdir jump|del <alias>
+	const char *p=line+strspn(line, " \t");
+	if (strncmp(p, "shortdir", 8)!=0 || (p[8]!=' ' && p[8]!='\t'))
+		return COMPLETE_FILE;
+	p+=8;
+	p+=strspn(p, " \t");
+	size_t op=strcspn(p, " \t");
+	if (!((op==4 && strncmp(p, "jump", 4)==0) || (op==3 && strncmp(p, "del", 3)==0)))
+		return COMPLETE_FILE;
+	p+=op;
+	p+=strspn(p, " \t");
+	return (size_t)(p-line)==start?COMPLETE_SHORTDIR:COMPLETE_FILE;
+}
+/**
+ * Line editor. The terminal settings are read once per session and the
+ * terminal stays in raw mode between prompts; it only goes back to the
+ * saved mode while a foreground job owns it. Input is read in blocks with
+ * read(), and after each block the line is redrawn with a single write().
+ */
+static struct termios backup_termios, raw_termios;
+static bool termios_loaded, termios_raw;
+/**
+ * Switch the terminal to raw mode for editing, no-op if it already is
+ */
+void terminal_raw()
+{
+	if (!termios_loaded)
+	{
+		// tcgetattr gets the parameters of the current terminal
+		if (tcgetattr(STDIN_FILENO, &backup_termios)==-1) return;
+		raw_termios=backup_termios;
+		// no line buffering, no echo (we draw the line) and no signals
+		// from ^C/^Z, which the editor handles itself
+		raw_termios.c_lflag &= ~(ICANON | ECHO | ISIG);
+		raw_termios.c_cc[VMIN]=1;
+		raw_termios.c_cc[VTIME]=0;
+		termios_loaded=true;
+	}
+	if (!termios_raw && tcsetattr(STDIN_FILENO, TCSANOW, &raw_termios)==0)
+		termios_raw=true;
+}
+/**
+ * Give back the terminal settings the shell started with
+ */
+void terminal_restore()
+{
+	if (termios_raw && tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios)==0)
+		termios_raw=false;
+}
+struct line_editor {
+	char *buf; // the line, not NUL terminated while editing
+	size_t len;
+	size_t capacity;
+	size_t cursor;
+	char prompt[2200];
+	size_t prompt_len;
+	int columns; // terminal width
+	int cursor_row; // row of the cursor in the last render, from the prompt
+	char *out; // pending terminal output, sent with one write()
+	size_t out_len;
+	size_t out_capacity;
+};
+static struct line_editor editor;
+static long history_pos=-1; // record shown by up/down, -1 when not browsing
+static char *history_saved_line; // line being edited before browsing
+// input read ahead of the current line, e.g. the rest of a paste
+static char input_buf[4096];
+static size_t input_pos, input_len;
+
+static void editor_emit(const char *data, size_t len)
+{
+	if (editor.out_len+len>editor.out_capacity)
+	{
+		editor.out_capacity=(editor.out_len+len)*2;
+		editor.out=realloc(editor.out, editor.out_capacity);
+	}
+	memcpy(editor.out+editor.out_len, data, len);
+	editor.out_len+=len;
+}
+static void editor_emitf(const char *format, int value)
+{
+	char seq[32];
+	int n=snprintf(seq, sizeof(seq), format, value);
+	editor_emit(seq, n);
+}
+static void editor_flush()
+{
+	size_t done=0;
+	while (done<editor.out_len)
+	{
+		ssize_t n=write(STDOUT_FILENO, editor.out+done, editor.out_len-done);
+		if (n==-1 && errno==EINTR) continue;
+		if (n<=0) break;
+		done+=n;
+	}
+	editor.out_len=0;
+}
+/**
+ * Queue a full redraw of prompt and line, leaving the cursor in place.
+ * Handles lines that wrap over several terminal rows.
+ */
+static void editor_refresh()
+{
+	int width=editor.columns;
+	size_t end=editor.prompt_len+editor.len;
+	size_t at=editor.prompt_len+editor.cursor;
+
+	if (editor.cursor_row>0) // back to the row the prompt starts on
+		editor_emitf("\x1b[%dA", editor.cursor_row);
+	editor_emit("\r", 1);
+	editor_emit(editor.prompt, editor.prompt_len);
+	editor_emit(editor.buf, editor.len);
+	editor_emit("\x1b[J", 3); // clear whatever the old line left behind
+	int end_row=end/width;
+	if (end>0 && end%width==0) // terminal waits at the margin, make it wrap
+		editor_emit("\r\n", 2);
+	int row=at/width, column=at%width;
+	if (end_row>row)
+		editor_emitf("\x1b[%dA", end_row-row);
+	editor_emit("\r", 1);
+	if (column>0)
+		editor_emitf("\x1b[%dC", column);
+	editor.cursor_row=row;
+}
+static void editor_insert(const char *data, size_t len)
+{
+	if (editor.len+len>editor.capacity)
+	{
+		editor.capacity=(editor.len+len)*2;
+		editor.buf=realloc(editor.buf, editor.capacity);
+	}
+	memmove(editor.buf+editor.cursor+len, editor.buf+editor.cursor, editor.len-editor.cursor);
+	memcpy(editor.buf+editor.cursor, data, len);
+	editor.len+=len;
+	editor.cursor+=len;
+}
+static void editor_delete(size_t from, size_t to)
+{
+	memmove(editor.buf+from, editor.buf+to, editor.len-to);
+	editor.len-=to-from;
+	editor.cursor=from;
+}
+static void editor_set_line(const char *line)
+{
+	editor.len=editor.cursor=0;
+	editor_insert(line, strlen(line));
+}
+static bool is_word_char(char c)
+{
+	return c!=' ' && c!='\t' && c!='/' && c!='|' && c!='&' && c!='<' && c!='>';
+}
+static size_t word_left(size_t i)
+{
+	while (i>0 && !is_word_char(editor.buf[i-1])) i--;
+	while (i>0 && is_word_char(editor.buf[i-1])) i--;
+	return i;
+}
+static size_t word_right(size_t i)
+{
+	while (i<editor.len && !is_word_char(editor.buf[i])) i++;
+	while (i<editor.len && is_word_char(editor.buf[i])) i++;
+	return i;
+}
+/**
+ * Fill the prompt text: user@host:cwd seashell$
+ */
+static void build_prompt()
+{
+	char cwd[1024], hostname[1024];
+	const char *user=getenv("USER");
+	gethostname(hostname, sizeof(hostname));
+	if (getcwd(cwd, sizeof(cwd))==NULL) strcpy(cwd, "?");
+	editor.prompt_len=snprintf(editor.prompt, sizeof(editor.prompt), "%s@%s:%s %s$ ",
+		user?user:"", hostname, cwd, sysname);
+	if (editor.prompt_len>=sizeof(editor.prompt))
+		editor.prompt_len=sizeof(editor.prompt)-1;
+}
+/**
+ * Get the next input byte, waiting for the terminal while also watching
+ * the SIGCHLD pipe so finished background jobs are reported at once.
+ * @return byte, or -1 on end of input
+ */
+static int editor_getc()
+{
+	while (input_pos==input_len)
+	{
+		editor_flush();
+		struct pollfd fds[2]={{STDIN_FILENO, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+		if (poll(fds, 2, -1)==-1)
+		{
+			if (errno==EINTR) continue;
+			return -1;
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			jobs_reap();
+			if (jobs_have_news())
+			{ // print the report above a fresh copy of the line
+				if (editor.cursor_row>0)
+					editor_emitf("\x1b[%dA", editor.cursor_row);
+				editor_emit("\r\x1b[J", 4);
+				editor_flush();
+				jobs_notify();
+				fflush(stdout);
+				editor.cursor_row=0;
+				editor_refresh();
+			}
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			ssize_t n=read(STDIN_FILENO, input_buf, sizeof(input_buf));
+			if (n==-1 && errno==EINTR) continue;
+			if (n<=0) return -1;
+			input_pos=0;
+			input_len=n;
+		}
+	}
+	return (unsigned char)input_buf[input_pos++];
+}
+static bool editor_input_pending()
+{
+	return input_pos<input_len;
+}
+/**
+ * Show the previous history record
+ */
+static void editor_history_up()
+{
+	const char *text;
+	uint32_t len;
+	history_map();
+	if (history_pos==-1)
+	{ // start browsing from the newest record, remember the current line
+		free(history_saved_line);
+		history_saved_line=strndup(editor.buf?editor.buf:"", editor.len);
+		history_pos=history.map_size;
+	}
+	long offset=history_record_before(history_pos, &text, &len);
+	if (offset==-1) return;
+	history_pos=offset;
+	editor.len=editor.cursor=0;
+	editor_insert(text, len);
+}
+/**
+ * Show the next history record, or the line that was being edited
+ */
+static void editor_history_down()
+{
+	if (history_pos==-1) return;
+	size_t next=history_pos+8+history_u32(history_pos);
+	if (next+8<=history.map_size)
+	{
+		uint32_t len=history_u32(next);
+		history_pos=next;
+		editor.len=editor.cursor=0;
+		editor_insert(history.map+next+4, len);
+		return;
+	}
+	history_pos=-1;
+	editor_set_line(history_saved_line?history_saved_line:"");
+}
+/**
+ * Ctrl+R incremental reverse search. Typing narrows the query, Ctrl+R
+ * again moves to the next older match, Ctrl+G cancels and any other key
+ * keeps the match in the line.
+ * @return true if Enter was pressed and the match should run
+ */
+static bool editor_search()
+{
+	char saved_prompt[sizeof(editor.prompt)];
+	size_t saved_prompt_len=editor.prompt_len;
+	memcpy(saved_prompt, editor.prompt, saved_prompt_len);
+	char *original=strndup(editor.buf?editor.buf:"", editor.len);
+	char query[256];
+	size_t query_len=0;
+	long match=-1;
+	bool failed=false, run=false;
+	query[0]=0;
+
+	while (1)
+	{
+		editor.prompt_len=snprintf(editor.prompt, sizeof(editor.prompt), "(%sreverse-i-search)`%s': ",
+			failed?"failed ":"", query);
+		if (editor.prompt_len>=sizeof(editor.prompt))
+			editor.prompt_len=sizeof(editor.prompt)-1;
+		if (match!=-1)
+		{
+			uint32_t len;
+			const char *text=history_entry(match, &len);
+			editor.len=editor.cursor=0;
+			editor_insert(text, len);
+			const char *at=memmem(text, len, query, query_len);
+			editor.cursor=at?(size_t)(at-text):0;
+		}
+		editor_refresh();
+
+		int c=editor_getc();
+		long found;
+		if (c==18) // older match for the same query
+		{
+			found=match==-1?-1:history_search(query, match);
+			failed=found==-1;
+			if (found!=-1) match=found;
+			continue;
+		}
+		if (c==127 || c==8)
+		{
+			if (query_len>0) query[--query_len]=0;
+			match=query_len?history_search(query, UINT32_MAX):-1;
+			failed=query_len && match==-1;
+			continue;
+		}
+		if (c>=32 && query_len+1<sizeof(query))
+		{
+			query[query_len++]=c;
+			query[query_len]=0;
+			// the current match stays if it still contains the query
+			found=history_search(query, match==-1?UINT32_MAX:(uint32_t)match+1);
+			failed=found==-1;
+			if (found!=-1) match=found;
+			continue;
+		}
+		if (c==7 || c==3 || c==-1) // Ctrl+G / Ctrl+C cancel
+			editor_set_line(original);
+		else if (c=='\r' || c=='\n')
+			run=true;
+		break;
+	}
+	memcpy(editor.prompt, saved_prompt, saved_prompt_len);
+	editor.prompt_len=saved_prompt_len;
+	if (!run) editor.cursor=editor.len;
+	free(original);
+	return run;
+}
+/**
+ * Tab: complete the word before the cursor up to the longest common
+ * prefix of its candidates; a second Tab lists them when that is ambiguous
+ * @param  again the previous key was Tab too
+ * @return       true if the candidate list was printed and the line needs a redraw
+ */
+static bool editor_complete(bool again)
+{
+	size_t start=editor.cursor;
+	while (start>0 && (strchr(" \t|&<>", editor.buf[start-1])==NULL || (start>1 && editor.buf[start-2]=='\\')))
+		start--;
+	char word[PATH_MAX];
+	size_t len=0;
+	for (size_t i=start;i<editor.cursor && len<sizeof(word)-1;++i)
+	{ // the lexer's unescaping, enough for names
+		char c=editor.buf[i];
+		if (c=='\'' || c=='"') continue;
+		if (c=='\\' && i+1<editor.cursor) c=editor.buf[++i];
+		word[len++]=c;
+	}
+	word[len]=0;
+
+	char *line=strndup(editor.buf?editor.buf:"", editor.len);
+	int count=complete(completion_kind_at(line, start), word, len);
+	free(line);
+	if (count==0)
+	{
+		editor_emit("\a", 1);
+		return false;
+	}
+	const char *first=completions.items[0], *final=completions.items[count-1];
+	size_t common=0;
+	while (first[common] && first[common]==final[common]) common++;
+	if (common>len)
+	{
+		for (size_t i=len;i<common;++i)
+		{
+			if (strchr(" \t'\"\\|&<>", first[i])) editor_insert("\\", 1);
+			editor_insert(&first[i], 1);
+		}
+		if (count==1 && first[common-1]!='/')
+			editor_insert(" ", 1);
+		return false;
+	}
+	if (!again || count==1)
+	{
+		editor_emit("\a", 1);
+		return false;
+	}
+
+	// list below the line, then draw a fresh prompt under the list
+	size_t end=editor.prompt_len+editor.len;
+	int end_row=end/editor.columns;
+	if (end_row>editor.cursor_row)
+		editor_emitf("\x1b[%dB", end_row-editor.cursor_row);
+	editor_emit("\r\n", 2);
+	size_t width=0;
+	const char *slash=memrchr(word, '/', len);
+	size_t skip=slash?(size_t)(slash-word)+1:0; // list base names only
+	for (int i=0;i<count;++i)
+		if (strlen(completions.items[i])-skip>width) width=strlen(completions.items[i])-skip;
+	width+=2;
+	int columns=editor.columns/width>0?editor.columns/width:1;
+	int rows=(count+columns-1)/columns;
+	for (int row=0;row<rows;++row)
+	{
+		for (int column=0;column<columns;++column)
+		{
+			int i=column*rows+row;
+			if (i>=count) break;
+			const char *name=completions.items[i]+skip;
+			size_t name_len=strlen(name);
+			editor_emit(name, name_len);
+			if (column<columns-1 && (column+1)*rows+row<count)
+				for (size_t pad=name_len;pad<width;++pad)
+					editor_emit(" ", 1);
+		}
+		editor_emit("\r\n", 2);
+	}
+	editor.cursor_row=0;
+	return true;
+}
+/**
+ * Prompt a command from the user
+ * @param  command filled with the parsed line
+ * @return         SUCCESS, or EXIT on ^D / end of input
+ */
+int prompt(struct command_t *command)
+{
+	struct winsize ws;
+	editor.columns=(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)==0 && ws.ws_col>0)?ws.ws_col:80;
+	editor.len=editor.cursor=0;
+	editor.cursor_row=0;
+	build_prompt();
+	history_pos=-1;
+	terminal_raw();
+	fflush(stdout);
+	editor_refresh();
+
+	bool done=false, dirty=false;
+	int code=SUCCESS, last=0;
+	while (!done)
+	{
+		int c=editor_getc();
+		size_t before_len=editor.len, before_cursor=editor.cursor;
+		switch (c)
+		{
+		case -1: // end of input
+		case 4: // Ctrl+D, deletes under the cursor unless the line is empty
+			if (c==-1 || editor.len==0)
+			{
+				code=EXIT;
+				done=true;
+			}
+			else if (editor.cursor<editor.len)
+				editor_delete(editor.cursor, editor.cursor+1);
+			break;
+		case '\r':
+		case '\n':
+			done=true;
+			break;
+		case 9: // tab
+			if (editor_complete(last==9))
+				dirty=true;
+			break;
+		case 127: // backspace
+		case 8:
+			if (editor.cursor>0)
+				editor_delete(editor.cursor-1, editor.cursor);
+			break;
+		case 1: // Ctrl+A
+			editor.cursor=0;
+			break;
+		case 5: // Ctrl+E
+			editor.cursor=editor.len;
+			break;
+		case 2: // Ctrl+B
+			if (editor.cursor>0) editor.cursor--;
+			break;
+		case 6: // Ctrl+F
+			if (editor.cursor<editor.len) editor.cursor++;
+			break;
+		case 11: // Ctrl+K
+			editor.len=editor.cursor;
+			break;
+		case 21: // Ctrl+U
+			editor_delete(0, editor.cursor);
+			break;
+		case 23: // Ctrl+W
+			editor_delete(word_left(editor.cursor), editor.cursor);
+			break;
+		case 3: // Ctrl+C drops the line
+			editor.cursor=editor.len;
+			editor_refresh();
+			editor_emit("^C\r\n", 4);
+			editor.len=editor.cursor=0;
+			editor.cursor_row=0;
+			dirty=true;
+			break;
+		case 18: // Ctrl+R
+			if (editor_search())
+				done=true;
+			dirty=true;
+			break;
+		case 12: // Ctrl+L
+			editor_emit("\x1b[H\x1b[2J", 7);
+			editor.cursor_row=0;
+			dirty=true;
+			break;
+		case 27: // escape sequences
+		{
+			int c1=editor_getc(), c2=0;
+			if (c1=='b' || c1=='f') // Alt+B / Alt+F
+			{
+				editor.cursor=c1=='b'?word_left(editor.cursor):word_right(editor.cursor);
+				break;
+			}
+			if (c1!='[' && c1!='O') break;
+			c2=editor_getc();
+			if (c2>='0' && c2<='9')
+			{ // ESC [ n ~ or ESC [ 1 ; 5 C (Ctrl+arrow)
+				int n=c2-'0', modifier=0, final;
+				while ((final=editor_getc())>='0' && final<='9')
+					n=n*10+final-'0';
+				if (final==';')
+				{
+					while ((final=editor_getc())>='0' && final<='9')
+						modifier=modifier*10+final-'0';
+				}
+				if (final=='~')
+				{
+					if (n==1 || n==7) editor.cursor=0; // Home
+					else if (n==4 || n==8) editor.cursor=editor.len; // End
+					else if (n==3 && editor.cursor<editor.len) // Delete
+						editor_delete(editor.cursor, editor.cursor+1);
+				}
+				else if (modifier>1 && final=='C')
+					editor.cursor=word_right(editor.cursor);
+				else if (modifier>1 && final=='D')
+					editor.cursor=word_left(editor.cursor);
+				break;
+			}
+			switch (c2)
+			{
+			case 'A': // up arrow
+				editor_history_up();
+				break;
+			case 'B': // down arrow
+				editor_history_down();
+				break;
+			case 'C':
+				if (editor.cursor<editor.len) editor.cursor++;
+				break;
+			case 'D':
+				if (editor.cursor>0) editor.cursor--;
+				break;
+			case 'H':
+				editor.cursor=0;
+				break;
+			case 'F':
+				editor.cursor=editor.len;
+				break;
+			}
+			break;
+		}
+		default:
+			if (c>=32) // printable, including UTF-8 bytes
+			{
+				char ch=c;
+				editor_insert(&ch, 1);
+			}
+			break;
+		}
+		if (editor.len!=before_len || editor.cursor!=before_cursor)
+			dirty=true;
+		// coalesce everything that is already buffered, e.g. a paste,
+		// into one redraw
+		if (dirty && (done || !editor_input_pending()))
+		{
+			if (done)
+				editor.cursor=editor.len;
+			editor_refresh();
+			dirty=false;
+		}
+		last=c;
+	}
+	if (code!=EXIT)
+		editor_emit("\r\n", 2);
+	editor_flush();
+	if (code==EXIT)
+		return EXIT;
+
+	char *line=arena_strndup(&command_arena, editor.buf?editor.buf:"", editor.len);
+	if (strspn(line, " \t")<editor.len)
+		history_add(line);
+	parse_command(line, command); // command points into the arena copy
+
+	// print_command(command); // DEBUG: uncomment for debugging
+	return SUCCESS;
+}
+#define BATCH_READ_SIZE (1<<16)
+/**
+ * Parse and run one line of input outside the interactive prompt
+ * @param  line NUL terminated line, modified by the parser
+ * @return      EXIT if the line asked the shell to exit
+ */
+int run_line(char *line)
+{
+	while (*line==' ' || *line=='\t') line++;
+	if (*line==0 || *line=='#') // blank line or comment (and #! lines)
+		return SUCCESS;
+
+	struct command_t *command=arena_calloc(&command_arena, sizeof(struct command_t));
+	parse_command(line, command);
+	int code=process_command(command);
+	free_command(command);
+	jobs_reap();
+	jobs_notify();
+	return code;
+}
+/**
+ * Run every line of a string, as given to -c
+ * @param  text [description]
+ * @return      EXIT or SUCCESS
+ */
+int run_string(char *text)
+{
+	char *line=text, *end;
+	while ((end=strchr(line, '\n'))!=NULL)
+	{
+		*end=0;
+		if (run_line(line)==EXIT) return EXIT;
+		line=end+1;
+	}
+	return run_line(line);
+}
+/**
+ * Run commands read from a script or a pipe. Input is read in large
+ * blocks and split on newlines, lines may be of any length.
+ * @param  fd [description]
+ * @return    EXIT or SUCCESS
+ */
+int run_script(int fd)
+{
+	size_t capacity=BATCH_READ_SIZE, used=0;
+	char *buf=malloc(capacity+1);
+	ssize_t n;
+	int code=SUCCESS;
+
+	while (code!=EXIT)
+	{
+		if (capacity-used<BATCH_READ_SIZE/2) // keep reads large
+		{
+			capacity*=2;
+			buf=realloc(buf, capacity+1);
+		}
+		n=read(fd, buf+used, capacity-used);
+		if (n==-1 && errno==EINTR) continue;
+		if (n<=0) break;
+
+		size_t scanned=used; // everything before this has no newline
+		used+=n;
+		char *line=buf, *end;
+		while (code!=EXIT && (end=memchr(buf+scanned, '\n', used-scanned))!=NULL)
+		{
+			*end=0;
+			code=run_line(line);
+			line=end+1;
+			scanned=line-buf;
+		}
+		// move the unfinished line to the front
+		used-=line-buf;
+		memmove(buf, line, used);
+	}
+	if (code!=EXIT && used>0) // last line without a newline
+	{
+		buf[used]=0;
+		code=run_line(buf);
+	}
+	free(buf);
+	return code;
+}
+#ifndef SEASHELL_NO_MAIN
+int main(int argc, char *argv[])
+{
+	//save the current directory of the file 
+		getcwd(cd, sizeof(cd));
+
+	// seashell -c 'commands' | seashell script.sh | ... | seashell
+	if (argc==2 && strcmp(argv[1], "-c")==0)
+	{
+		fprintf(stderr, "%s: -c: option requires an argument\n", sysname);
+		return 2;
+	}
+	if (argc>2 && strcmp(argv[1], "-c")==0)
+	{
+		jobs_init(false);
+		run_string(argv[2]);
+		return 0;
+	}
+	if (argc>1)
+	{
+		int fd=open(argv[1], O_RDONLY | O_CLOEXEC);
+		if (fd==-1)
+		{
+			fprintf(stderr, "%s: %s: %s\n", sysname, argv[1], strerror(errno));
+			return 1;
+		}
+		jobs_init(false);
+		run_script(fd);
+		close(fd);
+		return 0;
+	}
+	if (!isatty(STDIN_FILENO)) // commands piped in, no prompt
+	{
+		jobs_init(false);
+		run_script(STDIN_FILENO);
+		return 0;
+	}
+	jobs_init(true);
+	history_open();
+
+	while (1)
+	{
+		struct command_t *command=arena_calloc(&command_arena, sizeof(struct command_t));
+
+		jobs_reap();
+		jobs_notify();
+
+		int code;
+		code = prompt(command);
+		if (code==EXIT) break;
+
+		// builtins in this process get ^C like jobs do, see interrupted
+		terminal_restore();
+		atomic_store(&interrupted, false);
+		code = process_command(command);
+		if (code==EXIT) break;
+
+		free_command(command);
+	}
+
+	terminal_restore();
+	printf("\n");
+	return 0;
+}
+#endif
+
+/**
+ * exit the shell
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_exit(struct command_t *command)
+{
+	(void)command;
+	return EXIT;
+}
+/**
+ * change the working directory, $HOME by default
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_cd(struct command_t *command)
+{
+	const char *dir=command->arg_count>0?command->args[0]:getenv("HOME");
+	if (dir==NULL)
+		return builtin_usage(command);
+	if (chdir(dir)==-1)
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+	return SUCCESS;
+}
+/**
+ * baca command. Question 6 implementation
+ * BaCa stands for Batu, Can.
+ * requires python3 being available in the terminal
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_baca(struct command_t *command)
+{
+	if (command->arg_count == 0){
+		pid_t pid=fork();
+		if (pid==0){//execvp called in fork() to prevent parent from terminating the seashell
+			//resolve python script path 
+			char * bacaPath = arena_alloc(&command_arena, strlen(cd) + sizeof("/chimneyAnimation.py"));
+			strcpy(bacaPath, cd);
+			strcat(bacaPath, "/chimneyAnimation.py");
+			char * arr[] = {"python3",bacaPath, NULL};
+			execvp("python3", arr);
+			exit(127);
+		}else{//parent
+			waitpid(pid, NULL, 0);
+			return SUCCESS;
+		} 
+	}
+	return builtin_usage(command);
+}
+/**
+ * Parallel for loop: calls run(context, i) for every i below count on up
+ * to threads threads. Indices are handed out in order through an atomic
+ * counter and the calling thread works too, so threads==1 runs inline.
+ * After ^C the remaining indices are skipped.
+ */
+struct parallel_for_t {
+	void (*run)(void *context, size_t index);
+	void *context;
+	size_t count;
+	atomic_size_t next;
+};
+static void *parallel_worker(void *arg)
+{
+	struct parallel_for_t *loop=arg;
+	size_t i;
+	while ((i=atomic_fetch_add(&loop->next, 1))<loop->count && !atomic_load(&interrupted))
+		loop->run(loop->context, i);
+	return NULL;
+}
+void parallel_for(int threads, size_t count, void (*run)(void *context, size_t index), void *context)
+{
+	struct parallel_for_t loop={run, context, count, 0};
+	if ((size_t)threads>count) threads=count;
+	pthread_t *ids=threads>1?malloc((threads-1)*sizeof(pthread_t)):NULL;
+	int started=0;
+	for (int t=1;t<threads;++t)
+		if (pthread_create(&ids[started], NULL, parallel_worker, &loop)==0)
+			started++;
+	parallel_worker(&loop);
+	for (int t=0;t<started;++t)
+		pthread_join(ids[t], NULL);
+	free(ids);
+}
+/**
+ * kdiff engine. Inputs are mmap'ed read-only. Binary comparison skips
+ * equal blocks with memcmp and counts the differing bytes of unequal
+ * blocks with a vector compare and a popcount of the mismatch mask, so
+ * it runs at memory bandwidth.
+ */
+#define KDIFF_BLOCK 4096
+#define KDIFF_CHUNK (16<<20) // bytes per task with -j, a multiple of KDIFF_BLOCK
+#define KDIFF_MAX_THREADS 256
+struct kdiff_file {
+	const char *path;
+	int fd;
+	unsigned char *data;
+	size_t size;
+	bool mapped;
+	struct stat st;
+};
+/**
+ * Map a file, or read it whole if it can't be mapped (pipes, devices)
+ * @param  file filled in
+ * @param  dir  directory fd path is relative to, or AT_FDCWD
+ * @param  path [description]
+ * @return      0 on success, -1 with errno set
+ */
+static int kdiff_open_at(struct kdiff_file *file, int dir, const char *path)
+{
+	struct stat st;
+	file->path=path;
+	file->data=NULL;
+	file->size=0;
+	file->mapped=false;
+	file->fd=openat(dir, path, O_RDONLY | O_CLOEXEC);
+	if (file->fd==-1) return -1;
+	if (fstat(file->fd, &st)==-1)
+		goto fail;
+	file->st=st;
+	if (S_ISDIR(st.st_mode))
+	{
+		errno=EISDIR;
+		goto fail;
+	}
+	if (S_ISREG(st.st_mode))
+	{
+		file->size=st.st_size;
+		if (file->size==0) return 0;
+		void *map=mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, file->fd, 0);
+		if (map!=MAP_FAILED)
+		{
+			madvise(map, file->size, MADV_SEQUENTIAL);
+			file->data=map;
+			file->mapped=true;
+			return 0;
+		}
+		file->size=0;
+	}
+	size_t capacity=0;
+	while (1)
+	{
+		if (file->size==capacity)
+		{
+			capacity=capacity?capacity*2:1<<20;
+			file->data=realloc(file->data, capacity);
+		}
+		ssize_t n=read(file->fd, file->data+file->size, capacity-file->size);
+		if (n==-1 && errno==EINTR) continue;
+		if (n==-1) goto fail;
+		if (n==0) break;
+		file->size+=n;
+	}
+	return 0;
+fail:
+	{
+		int saved=errno;
+		free(file->data);
+		file->data=NULL;
+		close(file->fd);
+		file->fd=-1;
+		errno=saved;
+	}
+	return -1;
+}
+static int kdiff_open(struct kdiff_file *file, const char *path)
+{
+	return kdiff_open_at(file, AT_FDCWD, path);
+}
+static void kdiff_close(struct kdiff_file *file)
+{
+	if (file->mapped)
+		munmap(file->data, file->size);
+	else
+		free(file->data);
+	if (file->fd!=-1)
+		close(file->fd);
+	file->fd=-1;
+	file->data=NULL;
+}
+/**
+ * 128-bit content hash: MurmurHash3 x64_128. Files up to KDIFF_CHUNK
+ * hash their bytes directly; bigger files hash the list of their chunk
+ * hashes, so the chunks of one file can be hashed in parallel.
+ */
+struct hash128 {
+	uint64_t h1;
+	uint64_t h2;
+};
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x<<r) | (x>>(64-r));
+}
+static inline uint64_t fmix64(uint64_t k)
+{
+	k^=k>>33;
+	k*=0xff51afd7ed558ccdULL;
+	k^=k>>33;
+	k*=0xc4ceb9fe1a85ec53ULL;
+	k^=k>>33;
+	return k;
+}
+struct hash128 murmur3_128(const void *key, size_t len, uint64_t seed)
+{
+	const unsigned char *data=key;
+	const uint64_t c1=0x87c37b91114253d5ULL, c2=0x4cf5ad432745937fULL;
+	uint64_t h1=seed, h2=seed, k1, k2;
+	size_t blocks=len/16;
+	for (size_t i=0;i<blocks;++i)
+	{
+		memcpy(&k1, data+i*16, 8);
+		memcpy(&k2, data+i*16+8, 8);
+		k1*=c1; k1=rotl64(k1, 31); k1*=c2; h1^=k1;
+		h1=rotl64(h1, 27); h1+=h2; h1=h1*5+0x52dce729;
+		k2*=c2; k2=rotl64(k2, 33); k2*=c1; h2^=k2;
+		h2=rotl64(h2, 31); h2+=h1; h2=h2*5+0x38495ab5;
+	}
+	const unsigned char *tail=data+blocks*16;
+	k1=k2=0;
+	switch (len & 15)
+	{
+	case 15: k2^=(uint64_t)tail[14]<<48; // fall through
+	case 14: k2^=(uint64_t)tail[13]<<40; // fall through
+	case 13: k2^=(uint64_t)tail[12]<<32; // fall through
+	case 12: k2^=(uint64_t)tail[11]<<24; // fall through
+	case 11: k2^=(uint64_t)tail[10]<<16; // fall through
+	case 10: k2^=(uint64_t)tail[9]<<8; // fall through
+	case 9: k2^=(uint64_t)tail[8];
+		k2*=c2; k2=rotl64(k2, 33); k2*=c1; h2^=k2;
+		// fall through
+	case 8: k1^=(uint64_t)tail[7]<<56; // fall through
+	case 7: k1^=(uint64_t)tail[6]<<48; // fall through
+	case 6: k1^=(uint64_t)tail[5]<<40; // fall through
+	case 5: k1^=(uint64_t)tail[4]<<32; // fall through
+	case 4: k1^=(uint64_t)tail[3]<<24; // fall through
+	case 3: k1^=(uint64_t)tail[2]<<16; // fall through
+	case 2: k1^=(uint64_t)tail[1]<<8; // fall through
+	case 1: k1^=(uint64_t)tail[0];
+		k1*=c1; k1=rotl64(k1, 31); k1*=c2; h1^=k1;
+	}
+	h1^=len;
+	h2^=len;
+	h1+=h2;
+	h2+=h1;
+	h1=fmix64(h1);
+	h2=fmix64(h2);
+	h1+=h2;
+	h2+=h1;
+	return (struct hash128){h1, h2};
+}
+static size_t kdiff_hash_chunks(size_t size)
+{
+	return size<=KDIFF_CHUNK?1:(size+KDIFF_CHUNK-1)/KDIFF_CHUNK;
+}
+static struct hash128 kdiff_hash_chunk(const struct kdiff_file *file, size_t chunk)
+{
+	size_t start=chunk*KDIFF_CHUNK;
+	size_t len=start>=file->size?0:file->size-start<KDIFF_CHUNK?file->size-start:KDIFF_CHUNK;
+	return murmur3_128(file->data+start, len, 0);
+}
+static struct hash128 kdiff_hash_combine(const struct hash128 *chunks, size_t count, size_t size)
+{
+	if (count==1) return chunks[0];
+	return murmur3_128(chunks, count*sizeof(struct hash128), size);
+}
+/**
+ * Persistent content hash cache: an open addressing table mmap'ed from
+ * a file in the startup directory, keyed by (dev, inode, size, mtime).
+ * A file whose key is found doesn't have to be read to know its hash.
+ * Slots carry a check word over their fields, so a slot torn by two
+ * shells writing at once reads as empty instead of as a wrong hash.
+ */
+#define KDIFF_CACHE_FILE ".kdiff_cache"
+#define KDIFF_CACHE_SLOTS (1<<16)
+#define KDIFF_CACHE_PROBES 16
+#define KDIFF_CACHE_MAGIC 0x316568636163646bULL // "kdcache1"
+enum kdiff_cache_mode {
+	KDIFF_CACHE_USE,
+	KDIFF_CACHE_OFF, // --no-cache: neither read nor write it
+	KDIFF_CACHE_VERIFY, // --verify: hash anyway, fix stale entries
+};
+struct kdiff_cache_slot {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	uint64_t mtime_ns;
+	struct hash128 hash;
+	uint64_t check;
+};
+struct kdiff_cache_header {
+	uint64_t magic;
+	uint64_t slots;
+};
+static struct {
+	bool opened;
+	struct kdiff_cache_header *header; // NULL if the cache is unusable
+	struct kdiff_cache_slot *slots;
+	pthread_mutex_t lock;
+} kdiff_cache={.lock=PTHREAD_MUTEX_INITIALIZER};
+
+static void kdiff_cache_open()
+{
+	char path[sizeof(cd)+sizeof(KDIFF_CACHE_FILE)+1];
+	size_t size=sizeof(struct kdiff_cache_header)+KDIFF_CACHE_SLOTS*sizeof(struct kdiff_cache_slot);
+	struct stat st;
+	kdiff_cache.opened=true;
+	snprintf(path, sizeof(path), "%s/%s", cd, KDIFF_CACHE_FILE);
+	int fd=open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd==-1) return;
+	if (fstat(fd, &st)==-1 || ((size_t)st.st_size<size && ftruncate(fd, size)==-1))
+	{
+		close(fd);
+		return;
+	}
+	void *map=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED) return;
+	kdiff_cache.header=map;
+	kdiff_cache.slots=(struct kdiff_cache_slot *)(kdiff_cache.header+1);
+	if (kdiff_cache.header->magic!=KDIFF_CACHE_MAGIC || kdiff_cache.header->slots!=KDIFF_CACHE_SLOTS)
+	{ // new file, or one from another layout
+		memset(kdiff_cache.slots, 0, KDIFF_CACHE_SLOTS*sizeof(struct kdiff_cache_slot));
+		kdiff_cache.header->slots=KDIFF_CACHE_SLOTS;
+		kdiff_cache.header->magic=KDIFF_CACHE_MAGIC;
+	}
+}
+static uint64_t kdiff_cache_check(const struct kdiff_cache_slot *slot)
+{
+	return fmix64(slot->dev ^ fmix64(slot->ino ^ fmix64(slot->size ^ fmix64(slot->mtime_ns
+		^ fmix64(slot->hash.h1 ^ fmix64(slot->hash.h2))))))|1; // never 0, the empty check
+}
+static void kdiff_cache_key(const struct stat *st, struct kdiff_cache_slot *key)
+{
+	key->dev=st->st_dev;
+	key->ino=st->st_ino;
+	key->size=st->st_size;
+	key->mtime_ns=st->st_mtim.tv_sec*1000000000ULL+st->st_mtim.tv_nsec;
+}
+static bool kdiff_cache_same_key(const struct kdiff_cache_slot *a, const struct kdiff_cache_slot *b)
+{
+	return a->dev==b->dev && a->ino==b->ino && a->size==b->size && a->mtime_ns==b->mtime_ns;
+}
+static size_t kdiff_cache_home(const struct kdiff_cache_slot *key)
+{
+	return fmix64(key->dev*0x9e3779b97f4a7c15ULL ^ key->ino) & (KDIFF_CACHE_SLOTS-1);
+}
+/**
+ * Look up the hash of a file
+ * @param  st   the file's stat
+ * @param  hash filled on a hit
+ * @return      true on a hit
+ */
+static bool kdiff_cache_lookup(const struct stat *st, struct hash128 *hash)
+{
+	if (!S_ISREG(st->st_mode)) return false;
+	struct kdiff_cache_slot key, slot;
+	bool hit=false;
+	kdiff_cache_key(st, &key);
+	pthread_mutex_lock(&kdiff_cache.lock);
+	if (!kdiff_cache.opened)
+		kdiff_cache_open();
+	for (size_t i=0;kdiff_cache.header && i<KDIFF_CACHE_PROBES;++i)
+	{
+		slot=kdiff_cache.slots[(kdiff_cache_home(&key)+i) & (KDIFF_CACHE_SLOTS-1)];
+		if (slot.check==0) break;
+		if (kdiff_cache_same_key(&slot, &key) && slot.check==kdiff_cache_check(&slot))
+		{
+			*hash=slot.hash;
+			hit=true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&kdiff_cache.lock);
+	return hit;
+}
+/**
+ * Remember the hash of a file. Files modified within the last second are
+ * skipped: a write in the same mtime tick would go unnoticed.
+ * @param st   the file's stat, taken before it was read
+ * @param hash [description]
+ */
+static void kdiff_cache_store(const struct stat *st, struct hash128 hash)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (!S_ISREG(st->st_mode) || st->st_mtim.tv_sec>=now.tv_sec-1) return;
+	struct kdiff_cache_slot key;
+	kdiff_cache_key(st, &key);
+	key.hash=hash;
+	key.check=kdiff_cache_check(&key);
+	pthread_mutex_lock(&kdiff_cache.lock);
+	if (!kdiff_cache.opened)
+		kdiff_cache_open();
+	if (kdiff_cache.header)
+	{
+		size_t home=kdiff_cache_home(&key), target=home; // a full window evicts its first slot
+		for (size_t i=0;i<KDIFF_CACHE_PROBES;++i)
+		{
+			size_t at=(home+i) & (KDIFF_CACHE_SLOTS-1);
+			const struct kdiff_cache_slot *slot=&kdiff_cache.slots[at];
+			if (slot->check==0 || kdiff_cache_same_key(slot, &key) || slot->check!=kdiff_cache_check(slot))
+			{
+				target=at;
+				break;
+			}
+		}
+		kdiff_cache.slots[target]=key;
+	}
+	pthread_mutex_unlock(&kdiff_cache.lock);
+}
+/**
+ * Settle a freshly computed hash with the cache: store it, and with
+ * --verify report an entry that disagreed
+ * @param st   [description]
+ * @param hash [description]
+ * @param mode [description]
+ * @param path for the stale entry warning
+ */
+static void kdiff_cache_update(const struct stat *st, struct hash128 hash, enum kdiff_cache_mode mode, const char *path)
+{
+	struct hash128 cached;
+	if (mode==KDIFF_CACHE_OFF) return;
+	if (kdiff_cache_lookup(st, &cached))
+	{
+		if (cached.h1==hash.h1 && cached.h2==hash.h2) return;
+		if (mode==KDIFF_CACHE_VERIFY)
+			printf("-%s: kdiff: %s: stale cache entry replaced\n", sysname, path);
+	}
+	kdiff_cache_store(st, hash);
+}
+struct kdiff_hash_work {
+	const struct kdiff_file *file;
+	struct hash128 *chunks;
+};
+static void kdiff_hash_task(void *context, size_t chunk)
+{
+	struct kdiff_hash_work *work=context;
+	work->chunks[chunk]=kdiff_hash_chunk(work->file, chunk);
+}
+/**
+ * Content hash of a whole file, the same value kdiff -r computes
+ */
+static struct hash128 kdiff_hash_file(const struct kdiff_file *file, int threads)
+{
+	size_t chunks=kdiff_hash_chunks(file->size);
+	struct kdiff_hash_work work={file, malloc(chunks*sizeof(struct hash128))};
+	parallel_for(threads, chunks, kdiff_hash_task, &work);
+	struct hash128 hash=kdiff_hash_combine(work.chunks, chunks, file->size);
+	free(work.chunks);
+	return hash;
+}
+/**
+ * Ask the cache whether two opened files are identical
+ * @return true if both are cached with the same hash
+ */
+static bool kdiff_cache_identical(const struct kdiff_file *a, const struct kdiff_file *b, enum kdiff_cache_mode mode)
+{
+	struct hash128 hash_a, hash_b;
+	if (mode!=KDIFF_CACHE_USE || a->size!=b->size) return false;
+	return kdiff_cache_lookup(&a->st, &hash_a) && kdiff_cache_lookup(&b->st, &hash_b)
+		&& hash_a.h1==hash_b.h1 && hash_a.h2==hash_b.h2;
+}
+/**
+ * Two files were just found identical by comparing them: hash one and
+ * cache it for both, so the next run can skip reading them
+ */
+static void kdiff_cache_identical_store(const struct kdiff_file *a, const struct kdiff_file *b, enum kdiff_cache_mode mode, int threads)
+{
+	if (mode==KDIFF_CACHE_OFF || !S_ISREG(a->st.st_mode) || !S_ISREG(b->st.st_mode)) return;
+	struct hash128 hash=kdiff_hash_file(a, threads);
+	kdiff_cache_update(&a->st, hash, mode, a->path);
+	kdiff_cache_update(&b->st, hash, mode, b->path);
+}
+/**
+ * Two files were found different: with --verify, hash both so entries
+ * that claimed otherwise get corrected
+ */
+static void kdiff_cache_different_store(const struct kdiff_file *a, const struct kdiff_file *b, enum kdiff_cache_mode mode, int threads)
+{
+	if (mode!=KDIFF_CACHE_VERIFY) return;
+	if (S_ISREG(a->st.st_mode))
+		kdiff_cache_update(&a->st, kdiff_hash_file(a, threads), mode, a->path);
+	if (S_ISREG(b->st.st_mode))
+		kdiff_cache_update(&b->st, kdiff_hash_file(b, threads), mode, b->path);
+}
+/**
+ * Count the positions where two buffers differ
+ * @param  a       [description]
+ * @param  b       [description]
+ * @param  len     bytes to compare
+ * @param  base    file offset of a[0], for the reported offsets
+ * @param  offsets filled with the first differing offsets, may be NULL
+ * @param  limit   capacity of offsets
+ * @param  found   offsets filled so far, updated
+ * @return         number of differing bytes
+ */
+static uint64_t kdiff_count_differences(const unsigned char *a, const unsigned char *b, size_t len,
+	uint64_t base, uint64_t *offsets, size_t limit, size_t *found)
+{
+	uint64_t count=0;
+	size_t i=0;
+	while (i<len)
+	{
+		size_t end=len-i<KDIFF_BLOCK?len:i+KDIFF_BLOCK;
+		if (memcmp(a+i, b+i, end-i)==0)
+		{
+			i=end;
+			continue;
+		}
+#if defined(__AVX2__)
+		for (;i+32<=end;i+=32)
+		{
+			__m256i x=_mm256_loadu_si256((const __m256i *)(a+i));
+			__m256i y=_mm256_loadu_si256((const __m256i *)(b+i));
+			uint32_t mask=~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+			if (mask==0) continue;
+			count+=__builtin_popcount(mask);
+			for (;mask && *found<limit;mask&=mask-1)
+				offsets[(*found)++]=base+i+__builtin_ctz(mask);
+		}
+#elif defined(__SSE2__)
+		for (;i+16<=end;i+=16)
+		{
+			__m128i x=_mm_loadu_si128((const __m128i *)(a+i));
+			__m128i y=_mm_loadu_si128((const __m128i *)(b+i));
+			uint32_t mask=~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+			if (mask==0) continue;
+			count+=__builtin_popcount(mask);
+			for (;mask && *found<limit;mask&=mask-1)
+				offsets[(*found)++]=base+i+__builtin_ctz(mask);
+		}
+#endif
+		for (;i<end;++i)
+		{
+			if (a[i]==b[i]) continue;
+			count++;
+			if (*found<limit)
+				offsets[(*found)++]=base+i;
+		}
+	}
+	return count;
+}
+struct kdiff_binary_chunk {
+	const struct kdiff_file *files;
+	size_t common;
+	size_t show_limit;
+	uint64_t *counts; // per chunk
+	uint64_t **offsets; // per chunk, show_limit each
+	size_t *found;
+};
+static void kdiff_binary_task(void *context, size_t chunk)
+{
+	struct kdiff_binary_chunk *work=context;
+	size_t start=chunk*KDIFF_CHUNK;
+	size_t len=work->common-start<KDIFF_CHUNK?work->common-start:KDIFF_CHUNK;
+	if (work->show_limit)
+		work->offsets[chunk]=malloc(work->show_limit*sizeof(uint64_t));
+	work->counts[chunk]=kdiff_count_differences(work->files[0].data+start, work->files[1].data+start, len,
+		start, work->offsets[chunk], work->show_limit, &work->found[chunk]);
+}
+/**
+ * kdiff -b: count differing bytes. Bytes past the end of the shorter
+ * file all count as different.
+ * @param  command    [description]
+ * @param  path1      [description]
+ * @param  path2      [description]
+ * @param  show_limit print the offsets of the first show_limit differences
+ * @param  threads    compare KDIFF_CHUNK sized chunks on this many threads
+ * @param  cache      how to use the hash cache
+ * @return            SUCCESS
+ */
+static int kdiff_binary(struct command_t *command, const char *path1, const char *path2, size_t show_limit, int threads,
+	enum kdiff_cache_mode cache)
+{
+	struct kdiff_file file1, file2;
+	if (kdiff_open(&file1, path1)==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path1, strerror(errno));
+		return SUCCESS;
+	}
+	if (kdiff_open(&file2, path2)==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path2, strerror(errno));
+		kdiff_close(&file1);
+		return SUCCESS;
+	}
+	if (kdiff_cache_identical(&file1, &file2, cache))
+	{
+		printf("The two files are identical\n");
+		kdiff_close(&file1);
+		kdiff_close(&file2);
+		return SUCCESS;
+	}
+	size_t common=file1.size<file2.size?file1.size:file2.size;
+	size_t longer=file1.size<file2.size?file2.size:file1.size;
+	uint64_t *offsets=show_limit?malloc(show_limit*sizeof(uint64_t)):NULL;
+	size_t found=0;
+	uint64_t count=0;
+	if (common>KDIFF_CHUNK)
+	{ // chunks are merged in file order, so the output matches one thread; ^C is noticed between them
+		struct kdiff_file files[2]={file1, file2};
+		size_t chunks=(common+KDIFF_CHUNK-1)/KDIFF_CHUNK;
+		struct kdiff_binary_chunk work={files, common, show_limit,
+			calloc(chunks, sizeof(uint64_t)), calloc(chunks, sizeof(uint64_t *)), calloc(chunks, sizeof(size_t))};
+		parallel_for(threads, chunks, kdiff_binary_task, &work);
+		for (size_t chunk=0;chunk<chunks;++chunk)
+		{
+			count+=work.counts[chunk];
+			for (size_t i=0;i<work.found[chunk] && found<show_limit;++i)
+				offsets[found++]=work.offsets[chunk][i];
+			free(work.offsets[chunk]);
+		}
+		free(work.counts);
+		free(work.offsets);
+		free(work.found);
+	}
+	else
+		count=kdiff_count_differences(file1.data, file2.data, common, 0, offsets, show_limit, &found);
+	count+=longer-common;
+	if (atomic_load(&interrupted))
+		goto done;
+
+	for (size_t i=0;i<found;++i)
+		printf("Offset %llu: %02x %02x\n", (unsigned long long)offsets[i],
+			file1.data[offsets[i]], file2.data[offsets[i]]);
+	for (size_t offset=common;offset<longer && found<show_limit;++offset, ++found)
+	{ // the tail of the longer file
+		if (file1.size>file2.size)
+			printf("Offset %llu: %02x EOF\n", (unsigned long long)offset, file1.data[offset]);
+		else
+			printf("Offset %llu: EOF %02x\n", (unsigned long long)offset, file2.data[offset]);
+	}
+	if (count==0)
+	{
+		printf("The two files are identical\n");
+		kdiff_cache_identical_store(&file1, &file2, cache, threads);
+	}
+	else
+	{
+		printf("The two files are different in %llu bytes\n", (unsigned long long)count);
+		kdiff_cache_different_store(&file1, &file2, cache, threads);
+	}
+done:
+	free(offsets);
+	kdiff_close(&file1);
+	kdiff_close(&file2);
+	return SUCCESS;
+}
+/**
+ * Line diff. Every line is hashed once and interned to an integer id
+ * shared by both files, so the diff itself only compares integers. The
+ * edit script is Myers' O(ND) greedy algorithm; its trace grows with D^2,
+ * so when that passes KDIFF_TRACE_BUDGET the linear-space divide and
+ * conquer variant (middle snake) is used instead.
+ */
+#define KDIFF_CONTEXT 3 // unchanged lines around each hunk
+#define KDIFF_TRACE_BUDGET (1<<22) // V entries kept for the greedy backtrack
+#define KDIFF_TEXT_PROBE 8192 // bytes checked for NUL to tell text from binary
+struct kdiff_lines {
+	size_t count;
+	size_t *start; // offset of each line in the file
+	uint32_t *len; // length including the newline, if any
+	uint64_t *hash;
+	uint32_t *id; // interned line
+	bool *changed; // set by the diff
+};
+struct kdiff_intern_slot {
+	uint64_t hash;
+	uint32_t id; // 0 for an empty slot, otherwise id+1
+	const unsigned char *line;
+	uint32_t len;
+};
+struct kdiff_diff {
+	const uint32_t *a;
+	const uint32_t *b;
+	bool *changed_a;
+	bool *changed_b;
+	int *forward; // middle snake diagonals
+	int *backward;
+};
+
+static uint64_t kdiff_hash_bytes(const unsigned char *p, size_t len)
+{
+	uint64_t h=0x9e3779b97f4a7c15ULL ^ len;
+	for (;len>=8;p+=8, len-=8)
+	{
+		uint64_t word;
+		memcpy(&word, p, 8);
+		h=(h ^ word)*0xff51afd7ed558ccdULL;
+		h^=h>>32;
+	}
+	uint64_t tail=0;
+	memcpy(&tail, p, len);
+	h=(h ^ tail)*0xc4ceb9fe1a85ec53ULL;
+	return h ^ (h>>29);
+}
+static bool kdiff_is_text(const struct kdiff_file *file)
+{
+	size_t probe=file->size<KDIFF_TEXT_PROBE?file->size:KDIFF_TEXT_PROBE;
+	return probe==0 || memchr(file->data, 0, probe)==NULL;
+}
+struct kdiff_split {
+	const struct kdiff_file *file;
+	struct kdiff_lines *lines;
+	size_t parts;
+	size_t *first_line; // per part: index of the first line starting in it
+};
+static size_t kdiff_count_newlines(const unsigned char *p, size_t len)
+{
+	size_t count=0, i=0;
+#if defined(__SSE2__)
+	const __m128i newline=_mm_set1_epi8('\n');
+	for (;i+16<=len;i+=16)
+		count+=__builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i)), newline)));
+#endif
+	for (;i<len;++i)
+		count+=p[i]=='\n';
+	return count;
+}
+// a line starts at 0 and after every newline that isn't the last byte
+static void kdiff_split_count(void *context, size_t part)
+{
+	struct kdiff_split *split=context;
+	size_t size=split->file->size, lo=size*part/split->parts, hi=size*(part+1)/split->parts;
+	size_t count=kdiff_count_newlines(split->file->data+lo, hi-lo);
+	if (hi==size && size>0 && split->file->data[size-1]=='\n')
+		count--;
+	split->first_line[part+1]=count+(part==0 && size>0);
+}
+static void kdiff_split_fill(void *context, size_t part)
+{
+	struct kdiff_split *split=context;
+	const unsigned char *data=split->file->data;
+	size_t size=split->file->size, lo=size*part/split->parts, hi=size*(part+1)/split->parts;
+	size_t line=split->first_line[part];
+	struct kdiff_lines *lines=split->lines;
+	if (part==0 && size>0)
+		lines->start[line++]=0;
+	for (const unsigned char *p=data+lo, *end=data+hi;(p=memchr(p, '\n', end-p))!=NULL && p+1<data+size;++p)
+		lines->start[line++]=p+1-data;
+}
+static void kdiff_split_hash(void *context, size_t part)
+{
+	struct kdiff_split *split=context;
+	struct kdiff_lines *lines=split->lines;
+	size_t lo=lines->count*part/split->parts, hi=lines->count*(part+1)/split->parts;
+	for (size_t i=lo;i<hi;++i)
+	{
+		size_t next=i+1<lines->count?lines->start[i+1]:split->file->size;
+		lines->len[i]=next-lines->start[i];
+		lines->hash[i]=kdiff_hash_bytes(split->file->data+lines->start[i], lines->len[i]);
+	}
+}
+/**
+ * Find the lines of a file and hash each of them. The file is cut into
+ * one byte range per thread: newlines are counted per range, a prefix
+ * sum gives each range its first line index, then the ranges fill in
+ * their line starts and hashes independently.
+ * @param file    [description]
+ * @param lines   filled in
+ * @param threads [description]
+ */
+static void kdiff_split_lines(const struct kdiff_file *file, struct kdiff_lines *lines, int threads)
+{
+	size_t parts=threads>1 && file->size>KDIFF_CHUNK?threads:1;
+	struct kdiff_split split={file, lines, parts, calloc(parts+1, sizeof(size_t))};
+	parallel_for(threads, parts, kdiff_split_count, &split);
+	for (size_t part=0;part<parts;++part)
+		split.first_line[part+1]+=split.first_line[part];
+	lines->count=split.first_line[parts];
+	lines->start=malloc((lines->count+1)*sizeof(size_t));
+	lines->len=malloc((lines->count+1)*sizeof(uint32_t));
+	lines->hash=malloc((lines->count+1)*sizeof(uint64_t));
+	lines->id=malloc((lines->count+1)*sizeof(uint32_t));
+	lines->changed=calloc(lines->count+1, sizeof(bool));
+	parallel_for(threads, parts, kdiff_split_fill, &split);
+	parallel_for(threads, parts, kdiff_split_hash, &split);
+	free(split.first_line);
+}
+static void kdiff_free_lines(struct kdiff_lines *lines)
+{
+	free(lines->start);
+	free(lines->len);
+	free(lines->hash);
+	free(lines->id);
+	free(lines->changed);
+}
+/**
+ * Give equal lines of both files the same id
+ */
+static void kdiff_intern(const struct kdiff_file *files, struct kdiff_lines *lines)
+{
+	size_t total=lines[0].count+lines[1].count, size=16;
+	while (size<total*2) size*=2;
+	struct kdiff_intern_slot *table=calloc(size, sizeof(struct kdiff_intern_slot));
+	uint32_t next_id=0;
+	for (int f=0;f<2;++f)
+	{
+		for (size_t i=0;i<lines[f].count;++i)
+		{
+			const unsigned char *line=files[f].data+lines[f].start[i];
+			uint64_t hash=lines[f].hash[i];
+			size_t slot=hash & (size-1);
+			while (table[slot].id && (table[slot].hash!=hash || table[slot].len!=lines[f].len[i]
+				|| memcmp(table[slot].line, line, lines[f].len[i])!=0))
+				slot=(slot+1) & (size-1);
+			if (table[slot].id==0)
+			{
+				table[slot].hash=hash;
+				table[slot].id=++next_id;
+				table[slot].line=line;
+				table[slot].len=lines[f].len[i];
+			}
+			lines[f].id[i]=table[slot].id-1;
+		}
+	}
+	free(table);
+}
+/**
+ * Greedy Myers with the V array of every step kept for the backtrack
+ * @return false if the trace would pass KDIFF_TRACE_BUDGET
+ */
+static bool kdiff_myers_trace(struct kdiff_diff *diff, int a0, int a1, int b0, int b1)
+{
+	int n=a1-a0, m=b1-b0, max=n+m;
+	int *v_base=malloc((2*max+3)*sizeof(int)), *v=v_base+max+1; // v[k] for k in -max-1..max+1
+	size_t trace_len=0, trace_capacity=1024;
+	int *trace=malloc(trace_capacity*sizeof(int)); // step d holds d+1 entries, k=-d,-d+2..d
+	v[1]=0;
+	int d, k=0;
+	for (d=0;d<=max;++d)
+	{
+		if (trace_len+d+1>KDIFF_TRACE_BUDGET || atomic_load(&interrupted))
+		{
+			free(v_base);
+			free(trace);
+			return false;
+		}
+		if (trace_len+d+1>trace_capacity)
+		{
+			trace_capacity=(trace_len+d+1)*2;
+			trace=realloc(trace, trace_capacity*sizeof(int));
+		}
+		bool found=false;
+		for (k=-d;k<=d;k+=2)
+		{
+			int x=(k==-d || (k!=d && v[k-1]<v[k+1]))?v[k+1]:v[k-1]+1;
+			int y=x-k;
+			while (x<n && y<m && diff->a[a0+x]==diff->b[b0+y])
+				x++, y++;
+			v[k]=x;
+			trace[trace_len+(k+d)/2]=x;
+			if (x>=n && y>=m)
+			{
+				found=true;
+				break;
+			}
+		}
+		trace_len+=d+1;
+		if (found) break;
+	}
+	// walk back from (n,m), one edit per step
+	for (;d>0;--d)
+	{
+		trace_len-=d+1;
+		const int *previous=trace+trace_len-d; // step d-1
+		int prev_k=(k==-d || (k!=d && previous[(k-1+d-1)/2]<previous[(k+1+d-1)/2]))?k+1:k-1;
+		int prev_x=previous[(prev_k+d-1)/2], prev_y=prev_x-prev_k;
+		if (prev_k==k+1)
+			diff->changed_b[b0+prev_y]=true; // insertion
+		else
+			diff->changed_a[a0+prev_x]=true; // deletion
+		k=prev_k;
+	}
+	free(v_base);
+	free(trace);
+	return true;
+}
+/**
+ * Find a point of the middle snake: a point on an optimal edit path
+ * that splits the edit script in two halves
+ */
+static void kdiff_middle_snake(struct kdiff_diff *diff, int a0, int a1, int b0, int b1, int *split_x, int *split_y)
+{
+	int n=a1-a0, m=b1-b0, delta=n-m, max=(n+m+1)/2;
+	bool odd=delta & 1;
+	int *vf=diff->forward+max+1, *vb=diff->backward+max+1;
+	vf[1]=0;
+	vb[1]=0;
+	for (int d=0;d<=max && !atomic_load(&interrupted);++d)
+	{
+		for (int k=-d;k<=d;k+=2)
+		{
+			int x=(k==-d || (k!=d && vf[k-1]<vf[k+1]))?vf[k+1]:vf[k-1]+1;
+			int y=x-k;
+			while (x<n && y<m && diff->a[a0+x]==diff->b[b0+y])
+				x++, y++;
+			vf[k]=x;
+			int back_k=delta-k;
+			if (odd && back_k>=-(d-1) && back_k<=d-1 && vf[k]+vb[back_k]>=n)
+			{
+				*split_x=a0+x;
+				*split_y=b0+y;
+				return;
+			}
+		}
+		for (int k=-d;k<=d;k+=2)
+		{ // same walk on the reversed sequences
+			int x=(k==-d || (k!=d && vb[k-1]<vb[k+1]))?vb[k+1]:vb[k-1]+1;
+			int y=x-k;
+			while (x<n && y<m && diff->a[a1-1-x]==diff->b[b1-1-y])
+				x++, y++;
+			vb[k]=x;
+			int forward_k=delta-k;
+			if (!odd && forward_k>=-d && forward_k<=d && vb[k]+vf[forward_k]>=n)
+			{
+				*split_x=a1-x;
+				*split_y=b1-y;
+				return;
+			}
+		}
+	}
+	*split_x=a0; // only after ^C, for non-empty inputs
+	*split_y=b0;
+}
+static void kdiff_myers(struct kdiff_diff *diff, int a0, int a1, int b0, int b1, bool linear)
+{
+	while (a0<a1 && b0<b1 && diff->a[a0]==diff->b[b0])
+		a0++, b0++;
+	while (a0<a1 && b0<b1 && diff->a[a1-1]==diff->b[b1-1])
+		a1--, b1--;
+	if (a0==a1 || b0==b1)
+	{
+		for (int i=a0;i<a1;++i) diff->changed_a[i]=true;
+		for (int j=b0;j<b1;++j) diff->changed_b[j]=true;
+		return;
+	}
+	if (!linear && kdiff_myers_trace(diff, a0, a1, b0, b1))
+		return;
+	if (atomic_load(&interrupted))
+		return;
+	int x, y;
+	kdiff_middle_snake(diff, a0, a1, b0, b1, &x, &y);
+	kdiff_myers(diff, a0, x, b0, y, true);
+	kdiff_myers(diff, x, a1, y, b1, true);
+}
+static void kdiff_print_line(char mark, const struct kdiff_file *file, const struct kdiff_lines *lines, size_t i)
+{
+	const unsigned char *line=file->data+lines->start[i];
+	uint32_t len=lines->len[i];
+	putchar(mark);
+	fwrite(line, 1, len, stdout);
+	if (len==0 || line[len-1]!='\n')
+		printf("\n\\ No newline at end of file\n");
+}
+static void kdiff_print_range(char side, size_t start, size_t count)
+{
+	if (count==1)
+		printf(" %c%zu", side, start+1);
+	else
+		printf(" %c%zu,%zu", side, count?start+1:start, count);
+}
+/**
+ * Print the changes as unified diff hunks
+ * @return number of changed lines, both sides
+ */
+static size_t kdiff_print_hunks(const struct kdiff_file *files, const struct kdiff_lines *lines)
+{
+	const struct kdiff_lines *a=&lines[0], *b=&lines[1];
+	size_t i=0, j=0, changes=0;
+	bool header=false;
+	while (i<a->count || j<b->count)
+	{
+		// skip to the next change; unchanged lines pair up one to one
+		while (i<a->count && j<b->count && !a->changed[i] && !b->changed[j])
+			i++, j++;
+		if (i>=a->count && j>=b->count) break;
+		size_t hunk_i=i>KDIFF_CONTEXT?i-KDIFF_CONTEXT:0;
+		size_t hunk_j=j-(i-hunk_i);
+		// extend the hunk while the next change is within two contexts
+		size_t end_i=i, end_j=j;
+		while (1)
+		{
+			while (end_i<a->count && a->changed[end_i]) end_i++;
+			while (end_j<b->count && b->changed[end_j]) end_j++;
+			size_t gap=0;
+			while (end_i+gap<a->count && end_j+gap<b->count && gap<=2*KDIFF_CONTEXT
+				&& !a->changed[end_i+gap] && !b->changed[end_j+gap])
+				gap++;
+			bool more=(end_i+gap<a->count && a->changed[end_i+gap]) || (end_j+gap<b->count && b->changed[end_j+gap]);
+			if (more && gap<=2*KDIFF_CONTEXT)
+			{
+				end_i+=gap;
+				end_j+=gap;
+				continue;
+			}
+			size_t context=gap<KDIFF_CONTEXT?gap:KDIFF_CONTEXT;
+			end_i+=context;
+			end_j+=context;
+			break;
+		}
+		if (!header)
+		{
+			printf("--- %s\n+++ %s\n", files[0].path, files[1].path);
+			header=true;
+		}
+		printf("@@");
+		kdiff_print_range('-', hunk_i, end_i-hunk_i);
+		kdiff_print_range('+', hunk_j, end_j-hunk_j);
+		printf(" @@\n");
+		i=hunk_i;
+		j=hunk_j;
+		while (i<end_i || j<end_j)
+		{
+			if (i<end_i && a->changed[i])
+			{
+				kdiff_print_line('-', &files[0], a, i++);
+				changes++;
+			}
+			else if (j<end_j && b->changed[j])
+			{
+				kdiff_print_line('+', &files[1], b, j++);
+				changes++;
+			}
+			else
+			{
+				kdiff_print_line(' ', &files[0], a, i++);
+				j++;
+			}
+		}
+	}
+	return changes;
+}
+/**
+ * kdiff -a: line diff of two text files, printed as unified hunks
+ * @param  command [description]
+ * @param  path1   [description]
+ * @param  path2   [description]
+ * @param  threads threads for splitting and hashing the lines
+ * @param  cache   how to use the hash cache
+ * @return         SUCCESS
+ */
+static int kdiff_text(struct command_t *command, const char *path1, const char *path2, int threads,
+	enum kdiff_cache_mode cache)
+{
+	struct kdiff_file files[2];
+	struct kdiff_lines lines[2];
+	if (kdiff_open(&files[0], path1)==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path1, strerror(errno));
+		return SUCCESS;
+	}
+	if (kdiff_open(&files[1], path2)==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path2, strerror(errno));
+		kdiff_close(&files[0]);
+		return SUCCESS;
+	}
+	if (!kdiff_is_text(&files[0]) || !kdiff_is_text(&files[1]))
+	{
+		printf("Files are not text files.\n");
+		kdiff_close(&files[0]);
+		kdiff_close(&files[1]);
+		return SUCCESS;
+	}
+	if (kdiff_cache_identical(&files[0], &files[1], cache))
+	{
+		printf("The two files are identical\n");
+		kdiff_close(&files[0]);
+		kdiff_close(&files[1]);
+		return SUCCESS;
+	}
+	for (int f=0;f<2;++f)
+	{
+		if (files[f].mapped)
+			madvise(files[f].data, files[f].size, MADV_WILLNEED); // lines are revisited for output
+		kdiff_split_lines(&files[f], &lines[f], threads);
+	}
+	kdiff_intern(files, lines);
+
+	int n=lines[0].count, m=lines[1].count;
+	struct kdiff_diff diff={lines[0].id, lines[1].id, lines[0].changed, lines[1].changed, NULL, NULL};
+	diff.forward=malloc(((n+m+1)/2*2+3)*sizeof(int));
+	diff.backward=malloc(((n+m+1)/2*2+3)*sizeof(int));
+	kdiff_myers(&diff, 0, n, 0, m, false);
+	free(diff.forward);
+	free(diff.backward);
+
+	if (atomic_load(&interrupted))
+		goto done; // the diff is incomplete, report nothing
+	size_t changes=kdiff_print_hunks(files, lines);
+	if (changes==0)
+	{
+		printf("The two files are identical\n");
+		kdiff_cache_identical_store(&files[0], &files[1], cache, threads);
+	}
+	else
+	{
+		printf("%zu different lines found\n", changes);
+		kdiff_cache_different_store(&files[0], &files[1], cache, threads);
+	}
+done:
+	for (int f=0;f<2;++f)
+	{
+		kdiff_free_lines(&lines[f]);
+		kdiff_close(&files[f]);
+	}
+	return SUCCESS;
+}
+/**
+ * Work-stealing pool. Every worker owns a deque: it pushes and pops new
+ * tasks at the back, so a directory walk goes depth first and stays
+ * cache warm, while idle workers steal the oldest task from the front of
+ * someone else's deque. pending counts tasks pushed but not finished;
+ * tasks push their children before returning, so zero means all done.
+ * A worker that finds nothing to steal sleeps on idle until a push or
+ * the end of the run.
+ */
+struct steal_pool;
+struct steal_task {
+	void (*run)(struct steal_pool *pool, int worker, void *arg);
+	void *arg;
+};
+struct steal_deque {
+	pthread_mutex_t lock;
+	struct steal_task *tasks; // ring buffer
+	size_t head;
+	size_t count;
+	size_t capacity;
+};
+struct steal_pool {
+	int workers;
+	struct steal_deque *deques;
+	atomic_long pending;
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle;
+	atomic_size_t pushes; // changed under idle_lock, so a push between a worker's scan and its wait is seen
+};
+struct steal_worker {
+	struct steal_pool *pool;
+	int id;
+};
+
+void steal_push(struct steal_pool *pool, int worker, void (*run)(struct steal_pool *pool, int worker, void *arg), void *arg)
+{
+	struct steal_deque *deque=&pool->deques[worker];
+	atomic_fetch_add(&pool->pending, 1);
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count==deque->capacity)
+	{
+		size_t capacity=deque->capacity?deque->capacity*2:64;
+		struct steal_task *tasks=malloc(capacity*sizeof(struct steal_task));
+		for (size_t i=0;i<deque->count;++i)
+			tasks[i]=deque->tasks[(deque->head+i)%deque->capacity];
+		free(deque->tasks);
+		deque->tasks=tasks;
+		deque->head=0;
+		deque->capacity=capacity;
+	}
+	deque->tasks[(deque->head+deque->count++)%deque->capacity]=(struct steal_task){run, arg};
+	pthread_mutex_unlock(&deque->lock);
+	pthread_mutex_lock(&pool->idle_lock);
+	atomic_fetch_add(&pool->pushes, 1);
+	pthread_cond_signal(&pool->idle);
+	pthread_mutex_unlock(&pool->idle_lock);
+}
+static bool steal_take(struct steal_deque *deque, bool back, struct steal_task *task)
+{
+	bool found=false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count>0)
+	{
+		found=true;
+		if (back)
+			*task=deque->tasks[(deque->head+deque->count-1)%deque->capacity];
+		else
+		{
+			*task=deque->tasks[deque->head];
+			deque->head=(deque->head+1)%deque->capacity;
+		}
+		deque->count--;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+static void *steal_worker_loop(void *arg)
+{
+	struct steal_worker *self=arg;
+	struct steal_pool *pool=self->pool;
+	struct steal_task task;
+	while (atomic_load(&pool->pending)>0)
+	{
+		size_t pushes=atomic_load(&pool->pushes);
+		bool found=steal_take(&pool->deques[self->id], true, &task);
+		for (int i=1;!found && i<pool->workers;++i)
+			found=steal_take(&pool->deques[(self->id+i)%pool->workers], false, &task);
+		if (!found)
+		{ // the tasks left are running and may still push more
+			pthread_mutex_lock(&pool->idle_lock);
+			while (atomic_load(&pool->pending)>0 && atomic_load(&pool->pushes)==pushes)
+				pthread_cond_wait(&pool->idle, &pool->idle_lock);
+			pthread_mutex_unlock(&pool->idle_lock);
+			continue;
+		}
+		task.run(pool, self->id, task.arg);
+		if (atomic_fetch_sub(&pool->pending, 1)==1)
+		{ // the last task: wake everyone to leave
+			pthread_mutex_lock(&pool->idle_lock);
+			pthread_cond_broadcast(&pool->idle);
+			pthread_mutex_unlock(&pool->idle_lock);
+		}
+	}
+	return NULL;
+}
+/**
+ * Run a task and everything it spawns on workers threads
+ * @param workers [description]
+ * @param run     first task, runs on worker 0 (the calling thread)
+ * @param arg     [description]
+ */
+void steal_pool_run(int workers, void (*run)(struct steal_pool *pool, int worker, void *arg), void *arg)
+{
+	struct steal_pool pool={workers, calloc(workers, sizeof(struct steal_deque)), 0,
+		PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+	struct steal_worker *selves=malloc(workers*sizeof(struct steal_worker));
+	pthread_t *threads=malloc(workers*sizeof(pthread_t));
+	for (int i=0;i<workers;++i)
+	{
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+		selves[i]=(struct steal_worker){&pool, i};
+	}
+	steal_push(&pool, 0, run, arg);
+	int started=0;
+	for (int i=1;i<workers;++i)
+		if (pthread_create(&threads[started], NULL, steal_worker_loop, &selves[i])==0)
+			started++;
+	steal_worker_loop(&selves[0]);
+	for (int i=0;i<started;++i)
+		pthread_join(threads[i], NULL);
+	for (int i=0;i<workers;++i)
+	{
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].tasks);
+	}
+	pthread_mutex_destroy(&pool.idle_lock);
+	pthread_cond_destroy(&pool.idle);
+	free(pool.deques);
+	free(selves);
+	free(threads);
+}
+/**
+ * kdiff -r: compare two directory trees. Every directory pair is a task
+ * that reads both listings with getdents64, sorts and merges them and
+ * spawns tasks for subdirectories and for regular files whose sizes
+ * match. Files are hashed chunk by chunk, each chunk its own task, so
+ * one huge file spreads over all workers like a deep tree does.
+ */
+struct kdiff_entry {
+	char *name;
+	unsigned char type; // DT_*
+};
+struct kdiff_result {
+	char *path;
+	char status; // '+' added, '-' removed, '~' changed
+};
+struct kdiff_tree {
+	const char *paths[2];
+	int roots[2];
+	pthread_mutex_t lock;
+	struct kdiff_result *results;
+	size_t result_count;
+	size_t result_capacity;
+	atomic_size_t errors;
+	const char *name; // for error messages
+	enum kdiff_cache_mode cache;
+};
+struct kdiff_dir_task {
+	struct kdiff_tree *tree;
+	char path[]; // relative to the roots, "" for the roots themselves
+};
+struct kdiff_file_job {
+	struct kdiff_tree *tree;
+	char *path;
+	struct stat st[2]; // taken before reading, the cache keys
+	struct kdiff_file files[2];
+	size_t chunks;
+	struct hash128 *hashes; // chunks per side
+	atomic_size_t remaining;
+};
+struct kdiff_chunk_task {
+	struct kdiff_file_job *job;
+	int side;
+	size_t chunk;
+};
+struct linux_dirent64 {
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static void kdiff_tree_report(struct kdiff_tree *tree, const char *path, char status)
+{
+	pthread_mutex_lock(&tree->lock);
+	if (tree->result_count==tree->result_capacity)
+	{
+		tree->result_capacity=tree->result_capacity?tree->result_capacity*2:64;
+		tree->results=realloc(tree->results, tree->result_capacity*sizeof(struct kdiff_result));
+	}
+	tree->results[tree->result_count++]=(struct kdiff_result){strdup(path), status};
+	pthread_mutex_unlock(&tree->lock);
+}
+static void kdiff_tree_error(struct kdiff_tree *tree, int side, const char *path)
+{
+	printf("-%s: %s: %s/%s: %s\n", sysname, tree->name, tree->paths[side], path, strerror(errno));
+	atomic_fetch_add(&tree->errors, 1);
+}
+static int kdiff_entry_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct kdiff_entry *)a)->name, ((const struct kdiff_entry *)b)->name);
+}
+/**
+ * Read a directory with getdents64, sorted by name
+ * @return number of entries, or -1 on error
+ */
+static int kdiff_read_dir(int root, const char *path, struct kdiff_entry **entries)
+{
+	int fd=openat(root, *path?path:".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd==-1) return -1;
+	char buf[32768];
+	int count=0, capacity=0;
+	*entries=NULL;
+	while (1)
+	{
+		long n=syscall(SYS_getdents64, fd, buf, sizeof(buf));
+		if (n==-1 && errno==EINTR) continue;
+		if (n<=0)
+		{
+			if (n==-1)
+			{
+				int saved=errno;
+				for (int i=0;i<count;++i) free((*entries)[i].name);
+				free(*entries);
+				close(fd);
+				errno=saved;
+				return -1;
+			}
+			break;
+		}
+		for (long offset=0;offset<n;)
+		{
+			struct linux_dirent64 *d=(struct linux_dirent64 *)(buf+offset);
+			offset+=d->d_reclen;
+			if (strcmp(d->d_name, ".")==0 || strcmp(d->d_name, "..")==0) continue;
+			if (count==capacity)
+			{
+				capacity=capacity?capacity*2:32;
+				*entries=realloc(*entries, capacity*sizeof(struct kdiff_entry));
+			}
+			unsigned char type=d->d_type;
+			if (type==DT_UNKNOWN)
+			{
+				struct stat st;
+				if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW)==0)
+					type=S_ISDIR(st.st_mode)?DT_DIR:S_ISREG(st.st_mode)?DT_REG:S_ISLNK(st.st_mode)?DT_LNK:DT_UNKNOWN;
+			}
+			(*entries)[count++]=(struct kdiff_entry){strdup(d->d_name), type};
+		}
+	}
+	close(fd);
+	if (count>1)
+		qsort(*entries, count, sizeof(struct kdiff_entry), kdiff_entry_compare);
+	return count;
+}
+static void kdiff_file_job_finish(struct kdiff_file_job *job)
+{
+	struct hash128 a=kdiff_hash_combine(job->hashes, job->chunks, job->files[0].size);
+	struct hash128 b=kdiff_hash_combine(job->hashes+job->chunks, job->chunks, job->files[1].size);
+	if (a.h1!=b.h1 || a.h2!=b.h2)
+		kdiff_tree_report(job->tree, job->path, '~');
+	kdiff_cache_update(&job->st[0], a, job->tree->cache, job->path);
+	kdiff_cache_update(&job->st[1], b, job->tree->cache, job->path);
+	kdiff_close(&job->files[0]);
+	kdiff_close(&job->files[1]);
+	free(job->hashes);
+	free(job->path);
+	free(job);
+}
+static void kdiff_chunk_run(struct steal_pool *pool, int worker, void *arg)
+{
+	(void)pool;
+	(void)worker;
+	struct kdiff_chunk_task *task=arg;
+	struct kdiff_file_job *job=task->job;
+	job->hashes[task->side*job->chunks+task->chunk]=kdiff_hash_chunk(&job->files[task->side], task->chunk);
+	free(task);
+	if (atomic_fetch_sub(&job->remaining, 1)==1)
+		kdiff_file_job_finish(job);
+}
+static void kdiff_file_run(struct steal_pool *pool, int worker, void *arg)
+{
+	struct kdiff_file_job *job=arg;
+	if (atomic_load(&interrupted))
+	{
+		free(job->path);
+		free(job);
+		return;
+	}
+	for (int side=0;side<2;++side)
+	{
+		if (kdiff_open_at(&job->files[side], job->tree->roots[side], job->path)==-1)
+		{
+			kdiff_tree_error(job->tree, side, job->path);
+			if (side==1) kdiff_close(&job->files[0]);
+			free(job->path);
+			free(job);
+			return;
+		}
+	}
+	if (job->files[0].size!=job->files[1].size)
+	{ // changed since the walk stat'ed them, the chunks wouldn't line up
+		kdiff_tree_report(job->tree, job->path, '~');
+		kdiff_close(&job->files[0]);
+		kdiff_close(&job->files[1]);
+		free(job->path);
+		free(job);
+		return;
+	}
+	job->chunks=kdiff_hash_chunks(job->files[0].size);
+	job->hashes=malloc(2*job->chunks*sizeof(struct hash128));
+	if (job->chunks==1)
+	{ // small file, not worth a task per side
+		job->hashes[0]=kdiff_hash_chunk(&job->files[0], 0);
+		job->hashes[1]=kdiff_hash_chunk(&job->files[1], 0);
+		kdiff_file_job_finish(job);
+		return;
+	}
+	atomic_store(&job->remaining, 2*job->chunks);
+	for (int side=0;side<2;++side)
+		for (size_t chunk=0;chunk<job->chunks;++chunk)
+		{
+			struct kdiff_chunk_task *task=malloc(sizeof(struct kdiff_chunk_task));
+			*task=(struct kdiff_chunk_task){job, side, chunk};
+			steal_push(pool, worker, kdiff_chunk_run, task);
+		}
+}
+static void kdiff_join_into(char *path, const char *dir, const char *name)
+{
+	size_t dir_len=strlen(dir);
+	memcpy(path, dir, dir_len);
+	if (dir_len) path[dir_len++]='/';
+	strcpy(path+dir_len, name);
+}
+static char *kdiff_join(const char *dir, const char *name)
+{
+	char *path=malloc(strlen(dir)+strlen(name)+2);
+	kdiff_join_into(path, dir, name);
+	return path;
+}
+/**
+ * Compare two entries of the same name that are both regular files or
+ * both symlinks; anything needing the contents becomes a task
+ */
+static void kdiff_compare_entry(struct steal_pool *pool, int worker, struct kdiff_tree *tree, char *path, unsigned char type)
+{
+	struct stat st[2];
+	for (int side=0;side<2;++side)
+		if (fstatat(tree->roots[side], path, &st[side], AT_SYMLINK_NOFOLLOW)==-1)
+		{
+			kdiff_tree_error(tree, side, path);
+			free(path);
+			return;
+		}
+	if (type==DT_LNK)
+	{
+		char target[2][PATH_MAX];
+		ssize_t n0=readlinkat(tree->roots[0], path, target[0], PATH_MAX);
+		ssize_t n1=readlinkat(tree->roots[1], path, target[1], PATH_MAX);
+		if (n0!=n1 || (n0>0 && memcmp(target[0], target[1], n0)!=0))
+			kdiff_tree_report(tree, path, '~');
+		free(path);
+		return;
+	}
+	if ((st[0].st_mode & S_IFMT)!=(st[1].st_mode & S_IFMT) || st[0].st_size!=st[1].st_size)
+		kdiff_tree_report(tree, path, '~');
+	else if (S_ISREG(st[0].st_mode) && st[0].st_size>0
+		&& !(st[0].st_dev==st[1].st_dev && st[0].st_ino==st[1].st_ino)) // same inode, same file
+	{
+		struct hash128 hash[2];
+		if (tree->cache==KDIFF_CACHE_USE && kdiff_cache_lookup(&st[0], &hash[0]) && kdiff_cache_lookup(&st[1], &hash[1]))
+		{ // both known, nothing to read
+			if (hash[0].h1!=hash[1].h1 || hash[0].h2!=hash[1].h2)
+				kdiff_tree_report(tree, path, '~');
+			free(path);
+			return;
+		}
+		struct kdiff_file_job *job=calloc(1, sizeof(struct kdiff_file_job));
+		job->tree=tree;
+		job->path=path;
+		job->st[0]=st[0];
+		job->st[1]=st[1];
+		steal_push(pool, worker, kdiff_file_run, job);
+		return;
+	}
+	free(path);
+}
+static void kdiff_dir_run(struct steal_pool *pool, int worker, void *arg)
+{
+	struct kdiff_dir_task *task=arg;
+	struct kdiff_tree *tree=task->tree;
+	const char *dir=task->path;
+	struct kdiff_entry *entries[2];
+	int count[2];
+	if (atomic_load(&interrupted))
+	{ // ^C: let the pool drain
+		free(task);
+		return;
+	}
+	for (int side=0;side<2;++side)
+	{
+		count[side]=kdiff_read_dir(tree->roots[side], dir, &entries[side]);
+		if (count[side]==-1)
+		{
+			kdiff_tree_error(tree, side, dir);
+			if (side==1)
+			{
+				for (int i=0;i<count[0];++i) free(entries[0][i].name);
+				free(entries[0]);
+			}
+			free(task);
+			return;
+		}
+	}
+	int i=0, j=0;
+	while (i<count[0] || j<count[1])
+	{
+		int order=i==count[0]?1:j==count[1]?-1:strcmp(entries[0][i].name, entries[1][j].name);
+		if (order<0)
+		{
+			char *path=kdiff_join(dir, entries[0][i++].name);
+			kdiff_tree_report(tree, path, '-');
+			free(path);
+			continue;
+		}
+		if (order>0)
+		{
+			char *path=kdiff_join(dir, entries[1][j++].name);
+			kdiff_tree_report(tree, path, '+');
+			free(path);
+			continue;
+		}
+		unsigned char type=entries[0][i].type;
+		if (type!=entries[1][j].type)
+		{
+			char *path=kdiff_join(dir, entries[0][i].name);
+			kdiff_tree_report(tree, path, '~');
+			free(path);
+		}
+		else if (type==DT_DIR)
+		{
+			struct kdiff_dir_task *child=malloc(sizeof(struct kdiff_dir_task)+strlen(dir)+strlen(entries[0][i].name)+2);
+			child->tree=tree;
+			kdiff_join_into(child->path, dir, entries[0][i].name);
+			steal_push(pool, worker, kdiff_dir_run, child);
+		}
+		else
+			kdiff_compare_entry(pool, worker, tree, kdiff_join(dir, entries[0][i].name), type);
+		i++;
+		j++;
+	}
+	for (int side=0;side<2;++side)
+	{
+		for (int k=0;k<count[side];++k) free(entries[side][k].name);
+		free(entries[side]);
+	}
+	free(task);
+}
+static int kdiff_result_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct kdiff_result *)a)->path, ((const struct kdiff_result *)b)->path);
+}
+/**
+ * kdiff -r: report entries added, removed or changed between two trees
+ * @param  command [description]
+ * @param  path1   [description]
+ * @param  path2   [description]
+ * @param  threads workers of the pool
+ * @param  cache   how to use the hash cache
+ * @return         SUCCESS
+ */
+static int kdiff_tree(struct command_t *command, const char *path1, const char *path2, int threads,
+	enum kdiff_cache_mode cache)
+{
+	struct kdiff_tree tree={.paths={path1, path2}, .roots={-1, -1}, .name=command->name, .cache=cache};
+	for (int side=0;side<2;++side)
+	{
+		tree.roots[side]=open(tree.paths[side], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (tree.roots[side]==-1)
+		{
+			printf("-%s: %s: %s: %s\n", sysname, command->name, tree.paths[side], strerror(errno));
+			if (side==1) close(tree.roots[0]);
+			return SUCCESS;
+		}
+	}
+	pthread_mutex_init(&tree.lock, NULL);
+	struct kdiff_dir_task *root=malloc(sizeof(struct kdiff_dir_task)+1);
+	root->tree=&tree;
+	root->path[0]=0;
+	steal_pool_run(threads, kdiff_dir_run, root);
+
+	// tasks finish in any order, sort for a stable report
+	if (tree.result_count>1)
+		qsort(tree.results, tree.result_count, sizeof(struct kdiff_result), kdiff_result_compare);
+	if (atomic_load(&interrupted))
+	{ // the walk stopped early, report nothing
+		for (size_t i=0;i<tree.result_count;++i)
+			free(tree.results[i].path);
+		goto done;
+	}
+	size_t counts[3]={0};
+	for (size_t i=0;i<tree.result_count;++i)
+	{
+		struct kdiff_result *result=&tree.results[i];
+		if (result->status=='+')
+		{
+			printf("Added: %s\n", result->path);
+			counts[0]++;
+		}
+		else if (result->status=='-')
+		{
+			printf("Removed: %s\n", result->path);
+			counts[1]++;
+		}
+		else
+		{
+			printf("Changed: %s\n", result->path);
+			counts[2]++;
+		}
+		free(result->path);
+	}
+	if (tree.result_count==0 && atomic_load(&tree.errors)==0)
+		printf("The two directories are identical\n");
+	else if (tree.result_count>0)
+		printf("%zu added, %zu removed, %zu changed\n", counts[0], counts[1], counts[2]);
+done:
+	free(tree.results);
+	pthread_mutex_destroy(&tree.lock);
+	close(tree.roots[0]);
+	close(tree.roots[1]);
+	return SUCCESS;
+}
+/**
+ * kdiff --dups: find identical files among many. Files are narrowed in
+ * stages, each stage only looking at groups that survived the previous
+ * one: same size, then a hash of the first and last KDIFF_DUPS_EDGE bytes,
+ * then the full content hash (through the hash cache), and with --compare
+ * a final byte comparison against each group's first file. The hashing
+ * and comparing stages run on the thread pool.
+ */
+#define KDIFF_DUPS_EDGE 4096
+struct kdiff_dup {
+	char *path;
+	struct stat st;
+	struct hash128 partial; // hash of both edges, the full hash for small files
+	struct hash128 full;
+	bool failed; // couldn't be read, dropped
+	size_t group;
+};
+struct kdiff_dups {
+	struct kdiff_dup *files;
+	size_t count;
+	size_t capacity;
+	struct kdiff_dup **work; // files of the current stage
+	size_t work_count;
+	enum kdiff_cache_mode cache;
+	const char *name;
+};
+
+static void kdiff_dups_add(struct kdiff_dups *dups, const char *path, const struct stat *st)
+{
+	if (dups->count==dups->capacity)
+	{
+		dups->capacity=dups->capacity?dups->capacity*2:256;
+		dups->files=realloc(dups->files, dups->capacity*sizeof(struct kdiff_dup));
+	}
+	dups->files[dups->count++]=(struct kdiff_dup){.path=strdup(path), .st=*st};
+}
+/**
+ * Collect the non-empty regular files under a path. Symlinks found while
+ * walking are not followed, so the walk can't loop.
+ */
+static void kdiff_dups_collect(struct kdiff_dups *dups, const char *path, bool top)
+{
+	struct stat st;
+	if ((top?stat(path, &st):lstat(path, &st))==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, dups->name, path, strerror(errno));
+		return;
+	}
+	if (S_ISREG(st.st_mode))
+	{
+		if (st.st_size>0)
+			kdiff_dups_add(dups, path, &st);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) return;
+	struct kdiff_entry *entries;
+	int count=kdiff_read_dir(AT_FDCWD, path, &entries);
+	if (count==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, dups->name, path, strerror(errno));
+		return;
+	}
+	for (int i=0;i<count;++i)
+	{
+		if (entries[i].type==DT_DIR || entries[i].type==DT_REG)
+		{
+			char *child=kdiff_join(path, entries[i].name);
+			kdiff_dups_collect(dups, child, false);
+			free(child);
+		}
+		free(entries[i].name);
+	}
+	free(entries);
+}
+static void kdiff_dups_partial(void *context, size_t index)
+{
+	struct kdiff_dups *dups=context;
+	struct kdiff_dup *file=dups->work[index];
+	unsigned char edges[2*KDIFF_DUPS_EDGE];
+	size_t size=file->st.st_size, len=size<=2*KDIFF_DUPS_EDGE?size:2*KDIFF_DUPS_EDGE;
+	int fd=open(file->path, O_RDONLY | O_CLOEXEC);
+	if (fd==-1)
+	{
+		file->failed=true;
+		return;
+	}
+	bool ok;
+	if (size<=2*KDIFF_DUPS_EDGE)
+		ok=pread(fd, edges, size, 0)==(ssize_t)size;
+	else
+		ok=pread(fd, edges, KDIFF_DUPS_EDGE, 0)==KDIFF_DUPS_EDGE
+			&& pread(fd, edges+KDIFF_DUPS_EDGE, KDIFF_DUPS_EDGE, size-KDIFF_DUPS_EDGE)==KDIFF_DUPS_EDGE;
+	close(fd);
+	file->failed=!ok;
+	// a small file is read whole: its edge hash is its content hash
+	file->partial=murmur3_128(edges, len, size<=2*KDIFF_DUPS_EDGE?0:size);
+	if (size<=2*KDIFF_DUPS_EDGE)
+		file->full=file->partial;
+}
+static void kdiff_dups_full(void *context, size_t index)
+{
+	struct kdiff_dups *dups=context;
+	struct kdiff_dup *file=dups->work[index];
+	if (file->st.st_size<=2*KDIFF_DUPS_EDGE) return;
+	if (dups->cache==KDIFF_CACHE_USE && kdiff_cache_lookup(&file->st, &file->full)) return;
+	struct kdiff_file contents;
+	if (kdiff_open(&contents, file->path)==-1)
+	{
+		file->failed=true;
+		return;
+	}
+	file->full=kdiff_hash_file(&contents, 1);
+	kdiff_cache_update(&file->st, file->full, dups->cache, file->path);
+	kdiff_close(&contents);
+}
+static bool kdiff_dup_same_size(const struct kdiff_dup *x, const struct kdiff_dup *y)
+{
+	return x->st.st_size==y->st.st_size;
+}
+static bool kdiff_dup_same_partial(const struct kdiff_dup *x, const struct kdiff_dup *y)
+{
+	return x->st.st_size==y->st.st_size && x->partial.h1==y->partial.h1 && x->partial.h2==y->partial.h2;
+}
+static bool kdiff_dup_same_full(const struct kdiff_dup *x, const struct kdiff_dup *y)
+{
+	return x->st.st_size==y->st.st_size && x->full.h1==y->full.h1 && x->full.h2==y->full.h2;
+}
+static int kdiff_dup_compare_size(const void *a, const void *b)
+{
+	const struct kdiff_dup *x=*(struct kdiff_dup * const *)a, *y=*(struct kdiff_dup * const *)b;
+	if (x->st.st_size!=y->st.st_size) return x->st.st_size<y->st.st_size?-1:1;
+	return strcmp(x->path, y->path);
+}
+static int kdiff_dup_compare_partial(const void *a, const void *b)
+{
+	const struct kdiff_dup *x=*(struct kdiff_dup * const *)a, *y=*(struct kdiff_dup * const *)b;
+	if (x->st.st_size!=y->st.st_size) return x->st.st_size<y->st.st_size?-1:1;
+	if (x->partial.h1!=y->partial.h1) return x->partial.h1<y->partial.h1?-1:1;
+	if (x->partial.h2!=y->partial.h2) return x->partial.h2<y->partial.h2?-1:1;
+	return strcmp(x->path, y->path);
+}
+static int kdiff_dup_compare_full(const void *a, const void *b)
+{
+	const struct kdiff_dup *x=*(struct kdiff_dup * const *)a, *y=*(struct kdiff_dup * const *)b;
+	if (x->st.st_size!=y->st.st_size) return x->st.st_size<y->st.st_size?-1:1;
+	if (x->full.h1!=y->full.h1) return x->full.h1<y->full.h1?-1:1;
+	if (x->full.h2!=y->full.h2) return x->full.h2<y->full.h2?-1:1;
+	return strcmp(x->path, y->path);
+}
+static int kdiff_dup_compare_identity(const void *a, const void *b)
+{
+	const struct kdiff_dup *x=*(struct kdiff_dup * const *)a, *y=*(struct kdiff_dup * const *)b;
+	if (x->st.st_dev!=y->st.st_dev) return x->st.st_dev<y->st.st_dev?-1:1;
+	if (x->st.st_ino!=y->st.st_ino) return x->st.st_ino<y->st.st_ino?-1:1;
+	return x<y?-1:x>y; // collection order, the first path found is kept
+}
+static int kdiff_dup_compare_group(const void *a, const void *b)
+{
+	const struct kdiff_dup *x=*(struct kdiff_dup * const *)a, *y=*(struct kdiff_dup * const *)b;
+	if (x->group!=y->group) return x->group<y->group?-1:1;
+	return strcmp(x->path, y->path);
+}
+/**
+ * Drop unreadable files, sort the work list by a key and keep only the
+ * files that share their key with another file
+ */
+static void kdiff_dups_narrow(struct kdiff_dups *dups, int (*compare)(const void *, const void *),
+	bool (*same)(const struct kdiff_dup *, const struct kdiff_dup *))
+{
+	size_t kept=0;
+	for (size_t i=0;i<dups->work_count;++i)
+		if (!dups->work[i]->failed)
+			dups->work[kept++]=dups->work[i];
+	dups->work_count=kept;
+	if (dups->work_count>1)
+		qsort(dups->work, dups->work_count, sizeof(struct kdiff_dup *), compare);
+	kept=0;
+	for (size_t i=0;i<dups->work_count;)
+	{
+		size_t j=i+1;
+		while (j<dups->work_count && same(dups->work[i], dups->work[j]))
+			j++;
+		if (j-i>1)
+			for (size_t k=i;k<j;++k)
+				dups->work[kept++]=dups->work[k];
+		i=j;
+	}
+	dups->work_count=kept;
+}
+/**
+ * Keep one path per file. The same file is found again when a path is
+ * given twice or along with a directory above it, and through hard links;
+ * none of these are copies of it.
+ * @return number of hard links dropped, the other repeats are silent
+ */
+static size_t kdiff_dups_unique(struct kdiff_dups *dups)
+{
+	size_t kept=0, links=0, first=0; // first: start of the current file's run
+	if (dups->work_count>1)
+		qsort(dups->work, dups->work_count, sizeof(struct kdiff_dup *), kdiff_dup_compare_identity);
+	for (size_t i=0;i<dups->work_count;++i)
+	{
+		struct kdiff_dup *file=dups->work[i];
+		if (i==0 || dups->work[first]->st.st_dev!=file->st.st_dev || dups->work[first]->st.st_ino!=file->st.st_ino)
+		{
+			first=i;
+			dups->work[kept++]=file;
+			continue;
+		}
+		size_t seen=first; // a link is counted once however often its path was found
+		while (seen<i && strcmp(dups->work[seen]->path, file->path)!=0)
+			seen++;
+		if (seen==i && file->st.st_nlink>1) // else another spelling of one path
+			links++;
+	}
+	dups->work_count=kept;
+	return links;
+}
+struct kdiff_dups_groups {
+	struct kdiff_dups *dups;
+	size_t *starts; // work index of each group's first file
+	size_t count;
+	size_t next_group; // ids for the groups split off by --compare
+	pthread_mutex_t lock;
+};
+/**
+ * --compare: byte compare the files of a hash group. The group's first
+ * file is the reference; files that differ from it (a hash collision)
+ * form a new group with the next of them as reference, and so on.
+ */
+static void kdiff_dups_compare(void *context, size_t index)
+{
+	struct kdiff_dups_groups *groups=context;
+	struct kdiff_dup **work=groups->dups->work;
+	size_t start=groups->starts[index], end=groups->starts[index+1];
+	size_t *pending=malloc((end-start)*sizeof(size_t)), pending_count=0;
+	for (size_t i=start;i<end;++i)
+		pending[pending_count++]=i;
+	while (pending_count>0)
+	{
+		struct kdiff_dup *reference=work[pending[0]];
+		struct kdiff_file first, other;
+		size_t left=0, group=reference->group;
+		if (kdiff_open(&first, reference->path)==-1)
+		{
+			reference->failed=true;
+			memmove(pending, pending+1, --pending_count*sizeof(size_t));
+			continue;
+		}
+		for (size_t p=1;p<pending_count;++p)
+		{
+			struct kdiff_dup *file=work[pending[p]];
+			if (kdiff_open(&other, file->path)==-1)
+			{
+				file->failed=true;
+				continue;
+			}
+			size_t found=0;
+			if (other.size==first.size && kdiff_count_differences(first.data, other.data, first.size, 0, NULL, 0, &found)==0)
+				file->group=group;
+			else
+				pending[left++]=pending[p];
+			kdiff_close(&other);
+		}
+		kdiff_close(&first);
+		if (left>0)
+		{ // the rest needs a group id of its own
+			pthread_mutex_lock(&groups->lock);
+			size_t next=groups->next_group++;
+			pthread_mutex_unlock(&groups->lock);
+			for (size_t p=0;p<left;++p)
+				work[pending[p]]->group=next;
+		}
+		pending_count=left;
+	}
+	free(pending);
+}
+/**
+ * kdiff --dups: print groups of identical files
+ * @param  command [description]
+ * @param  paths   files and directories to search
+ * @param  count   [description]
+ * @param  threads [description]
+ * @param  compare byte compare the files of each group
+ * @param  cache   how to use the hash cache
+ * @return         SUCCESS
+ */
+static int kdiff_dups(struct command_t *command, char **paths, int count, int threads, bool compare,
+	enum kdiff_cache_mode cache)
+{
+	struct kdiff_dups dups={.cache=cache, .name=command->name};
+	for (int i=0;i<count;++i)
+		kdiff_dups_collect(&dups, paths[i], true);
+	dups.work=malloc((dups.count+1)*sizeof(struct kdiff_dup *));
+	for (size_t i=0;i<dups.count;++i)
+		dups.work[i]=&dups.files[i];
+	dups.work_count=dups.count;
+
+	size_t links=kdiff_dups_unique(&dups);
+	kdiff_dups_narrow(&dups, kdiff_dup_compare_size, kdiff_dup_same_size);
+	parallel_for(threads, dups.work_count, kdiff_dups_partial, &dups);
+	kdiff_dups_narrow(&dups, kdiff_dup_compare_partial, kdiff_dup_same_partial);
+	parallel_for(threads, dups.work_count, kdiff_dups_full, &dups);
+	kdiff_dups_narrow(&dups, kdiff_dup_compare_full, kdiff_dup_same_full);
+
+	// number the groups, the work list is sorted by (size, hash)
+	struct kdiff_dups_groups groups={&dups, malloc((dups.work_count+1)*sizeof(size_t)), 0, 0,
+		PTHREAD_MUTEX_INITIALIZER};
+	for (size_t i=0;i<dups.work_count;++i)
+	{
+		if (i==0 || !kdiff_dup_same_full(dups.work[i-1], dups.work[i]))
+			groups.starts[groups.count++]=i;
+		dups.work[i]->group=groups.count;
+	}
+	groups.starts[groups.count]=dups.work_count;
+	groups.next_group=groups.count+1;
+	if (compare)
+	{
+		parallel_for(threads, groups.count, kdiff_dups_compare, &groups);
+		for (size_t i=0;i<dups.work_count;++i)
+			if (dups.work[i]->failed) dups.work[i]->group=0;
+	}
+	if (atomic_load(&interrupted))
+		goto done; // hashing or comparing stopped early
+	if (dups.work_count>1)
+		qsort(dups.work, dups.work_count, sizeof(struct kdiff_dup *), kdiff_dup_compare_group);
+
+	size_t group_count=0, duplicates=0;
+	for (size_t i=0;i<dups.work_count;)
+	{
+		size_t j=i+1;
+		while (j<dups.work_count && dups.work[j]->group==dups.work[i]->group) j++;
+		if (dups.work[i]->group!=0 && j-i>1) // a split group may hold one file
+		{
+			if (group_count++>0) printf("\n");
+			for (size_t k=i;k<j;++k)
+				printf("%s\n", dups.work[k]->path);
+			duplicates+=j-i-1;
+		}
+		i=j;
+	}
+	if (group_count==0)
+		printf("No duplicate files found\n");
+	else
+		printf("\n%zu duplicate files in %zu groups\n", duplicates, group_count);
+	if (links>0)
+		printf("%zu hard links skipped, they are not copies\n", links);
+done:
+	for (size_t i=0;i<dups.count;++i)
+		free(dups.files[i].path);
+	free(dups.files);
+	free(dups.work);
+	free(groups.starts);
+	pthread_mutex_destroy(&groups.lock);
+	return SUCCESS;
+}
+/**
+ * kdiff command. implementation of Question5
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_kdiff(struct command_t *command)
+{
+	bool binary=false, recursive=false, dups=false, compare=false;
+	long show_limit=0, threads=1;
+	enum kdiff_cache_mode cache=KDIFF_CACHE_USE;
+	int i=0;
+	for (;i<command->arg_count && command->args[i][0]=='-';++i)
+	{
+		const char *option=command->args[i];
+		if (strcmp(option, "-a")==0)
+			binary=false;
+		else if (strcmp(option, "-b")==0)
+			binary=true;
+		else if (strcmp(option, "-r")==0)
+			recursive=true;
+		else if (strcmp(option, "--dups")==0)
+			dups=true;
+		else if (strcmp(option, "--compare")==0)
+			compare=true;
+		else if (strcmp(option, "--no-cache")==0)
+			cache=KDIFF_CACHE_OFF;
+		else if (strcmp(option, "--verify")==0)
+			cache=KDIFF_CACHE_VERIFY;
+		else if (strcmp(option, "-n")==0 && i+1<command->arg_count)
+		{
+			char *end;
+			show_limit=strtol(command->args[++i], &end, 10);
+			if (*end || show_limit<0)
+				return builtin_usage(command);
+		}
+		else if (strcmp(option, "-j")==0 && i+1<command->arg_count)
+		{
+			char *end;
+			threads=strtol(command->args[++i], &end, 10);
+			if (*end || threads<1 || threads>KDIFF_MAX_THREADS)
+				return builtin_usage(command);
+		}
+		else
+			return builtin_usage(command);
+	}
+	if (dups && i<command->arg_count)
+		return kdiff_dups(command, command->args+i, command->arg_count-i, threads, compare, cache);
+	if (command->arg_count-i!=2 || dups)
+		return builtin_usage(command);
+	if (recursive)
+		return kdiff_tree(command, command->args[i], command->args[i+1], threads, cache);
+	if (binary)
+		return kdiff_binary(command, command->args[i], command->args[i+1], show_limit, threads, cache);
+	return kdiff_text(command, command->args[i], command->args[i+1], threads, cache);
+}
+/**
+ * goodMorning command. implementation of Question4
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_goodMorning(struct command_t *command)
+{
+	
+	if (command->arg_count >= 2){
 
-	//goodMorning command. implementation of Question4
-	if (strcmp(command->name, "goodMorning")==0)
-	{
-		
-		if (command->arg_count >= 2){
-
-			//parse the arguments passed
-			char * scheduleDate = malloc(sizeof(char) * strlen(command->args[0]));
-			strcpy(scheduleDate, command->args[0]);
-			char * scheduledMusic = malloc(sizeof(char) * strlen(command->args[1]));
-			strcpy(scheduledMusic, command->args[1]);
-
-			//parse scheduledDate into minute and hour (those are separated by ".") 
-			char * scheduledHour = malloc(sizeof(char) * strlen(scheduleDate));
-			char * scheduledMinute = malloc(sizeof(char) * strlen(scheduleDate));
-			int hourCount = 0;
-			int minuteCount = 0;
-
-			bool minuteHourFlag = 0; // 0 is for hour & 1 is for minute
-			for(int i = 0; i < strlen(scheduleDate); i++){
-				//check for "."
-				if(scheduleDate[i] == '.'){
-					minuteHourFlag = 1;
-					continue;
-				}
+		//parse the arguments passed
+		char * scheduleDate = command->args[0];
+		char * scheduledMusic = command->args[1];
 
-				if(minuteHourFlag == 0){//for hour
-					// strcpy(scheduledHour[hourCount], scheduleDate[i]);
-					scheduledHour[hourCount] = scheduleDate[i];
-					hourCount++;
-				}else{//for hour
-					// strcpy(scheduledMinute[minuteCount], scheduleDate[i]);
-					scheduledMinute[minuteCount] = scheduleDate[i];
-					minuteCount++;
-				}
-			}
-			minuteHourFlag = 0;//reset the flag
-			hourCount = 0;//reset counts
-			minuteCount = 0;
-			// printf("hour: %s \t minute: %s \n", scheduledHour, scheduledMinute); //uncomment for debugging
-
-			//open file for writing the crontab info
-			//create path name to the text file
-			char * cronFilePath = malloc(sizeof(cd));
-			strcat(cronFilePath, cd);
-			strcat(cronFilePath,"/cronfile.txt");
-
-			//clear the file
-			remove(cronFilePath);
-			
-			FILE *fptr;
-			//file is open for both reading and appending & if file doesn't exists it is created
-			
-			fptr = fopen(cronFilePath,"a+"); 
-			
-			if(fptr == NULL){
-				printf("Error!");   
-			}
+		//parse scheduledDate into minute and hour (those are separated by ".") 
+		char * scheduledHour = arena_alloc(&command_arena, strlen(scheduleDate) + 1);
+		char * scheduledMinute = arena_alloc(&command_arena, strlen(scheduleDate) + 1);
+		int hourCount = 0;
+		int minuteCount = 0;
 
-			
-
-			//write crontab info to the file
-			fprintf(fptr,"%s %s * * * DISPLAY=:0.0 rhythmbox-client --play-uri %s\n", scheduledMinute, scheduledHour, scheduledMusic);
-			fclose(fptr);
-
-			//run crontab on crontfile.txt
-			pid_t pid=fork();
-			if (pid==0){//execvp called in fork() to prevent parent from terminating the seashell
-				char * arr[] = {"crontab",cronFilePath,NULL};
-				execvp("crontab", arr);
-				free(scheduleDate);
-				free(scheduledMusic);
-				free(scheduledHour);
-				free(scheduledMinute);
-				free(cronFilePath);
-			}else{//parent
-				wait(0);
-				return SUCCESS;
-			} 
-					
-		}
-	}
-
-	//highlight command. implementation of Question3
-	if (strcmp(command->name, "highlight")==0){
-
-		if (command->arg_count > 0){
-			//parse the input parameters
-			char * language = malloc(sizeof(char) * (strlen(command->args[0]) + 1));
-			char * color = malloc(sizeof(char) * (strlen(command->args[1]) + 1));
-			char * filePath = malloc(sizeof(char) * (strlen(command->args[2]) + 1));
-			strcpy(language, command->args[0]); 
-			strcpy(color, command->args[1]);
-			strcpy(filePath, command->args[2]); 
-
-			//color codes
-			char *DEFAULT = "\x1B[0m";
-			char *RED = "\x1B[41m";
-			char *GREEN = "\x1B[42m";
-			char *BLUE = "\x1B[44m";
-
-			//open the filePath txt file
-			//read and write rel. information to/from chdirMem.txt file
-			fptr0 = NULL;
-			//file is open for both reading and appending & if file doesn't exists it is created
-			
-			fptr0 = fopen(filePath,"a+"); 
-			
-			if(fptr0 == NULL){
-				printf("Error!");   
+		bool minuteHourFlag = 0; // 0 is for hour & 1 is for minute
+		for(size_t i = 0; i < strlen(scheduleDate); i++){
+			//check for "."
+			if(scheduleDate[i] == '.'){
+				minuteHourFlag = 1;
+				continue;
 			}
 
-			printf(" ");//for aesthetic purposes
-			
-			char * line = NULL;
-			size_t len = 0;
-			ssize_t read;
-			
-			//read txt file line by line
-			char arr[2000][50];
-			int index = 0;
-			int priorIndex = 0;
-			while ((read = getline(&line, &len, fptr0)) != -1) {
-				char* token2 = strtok(line, " ");
-				
-				while (token2 != NULL) {
-					strcpy(arr[index], token2);
-					index++;
-					token2 = strtok(NULL, " ");
-				}		
-
-				
-				for(int i = priorIndex; i< index; i++){
-
-					if(strcmp(language, arr[i]) == 0){//check if word is == language
-						//check for color code
-						if(strcmp(color, "r") == 0){
-							printf(RED);
-							printf("%s", language);
-							printf(DEFAULT);
-							printf(" ");
-						}else if(strcmp(color, "g") == 0){
-							printf(GREEN);
-							printf("%s", language);
-							printf(DEFAULT);
-							printf(" ");
-						}else if(strcmp(color, "b") == 0){
-							printf(BLUE);
-							printf("%s", language);
-							printf(DEFAULT);
-							printf(" ");
-						}
-
-					}else{ //if word != language
-						printf("%s ", arr[i]);
-					}
-				}	
-
-				priorIndex = index;
-				
-				
+			if(minuteHourFlag == 0){//for hour
+				// strcpy(scheduledHour[hourCount], scheduleDate[i]);
+				scheduledHour[hourCount] = scheduleDate[i];
+				hourCount++;
+			}else{//for hour
+				// strcpy(scheduledMinute[minuteCount], scheduleDate[i]);
+				scheduledMinute[minuteCount] = scheduleDate[i];
+				minuteCount++;
 			}
-			//free mem space
-			fclose(fptr0);
-			free(language);
-			free(color);
-			free(filePath);
-
-			
-
-			//highlight language r textFile.txt
-			printf("%s","\n");
-			return SUCCESS;
 		}
-	}
+		scheduledHour[hourCount] = '\0';
+		scheduledMinute[minuteCount] = '\0';
+		minuteHourFlag = 0;//reset the flag
+		hourCount = 0;//reset counts
+		minuteCount = 0;
+		// printf("hour: %s \t minute: %s \n", scheduledHour, scheduledMinute); //uncomment for debugging
 
-	//shortdir command. implementation of Question2
-	if (strcmp(command->name, "shortdir")==0){
-		//get current directory
-		char cwd[1000];
-		getcwd(cwd, sizeof(cwd));
+		//open file for writing the crontab info
 		//create path name to the text file
-		char * chdirMemPath = malloc(sizeof(cwd));
-		strcpy(chdirMemPath, cd);
-		strcat(chdirMemPath,"/chdirMem.txt");
-		//read and write rel. information to/from chdirMem.txt file
-		fptr = NULL;
+		char * cronFilePath = arena_alloc(&command_arena, strlen(cd) + sizeof("/cronfile.txt"));
+		strcpy(cronFilePath, cd);
+		strcat(cronFilePath,"/cronfile.txt");
+
+		//clear the file
+		remove(cronFilePath);
+		
+		FILE *fptr;
 		//file is open for both reading and appending & if file doesn't exists it is created
 		
-		fptr = fopen(chdirMemPath,"a+"); 
+		fptr = fopen(cronFilePath,"a+"); 
 		
 		if(fptr == NULL){
 			printf("Error!");   
-			
 		}
 
 		
-		
-		char* param = command->args[0];// passed param that indicates the operation {set, jump, del, clear, list}
-		if (command->arg_count == 2){// can be {set, jump, del} ops.
-		char* param2 = command->args[1]; // second passed param after the operation type
-
-			if(strcmp(param, "set") == 0){
-				char * writeParam = malloc(sizeof(char) * 1000);
-				strcat(writeParam, param2);
-				strcat(writeParam, "$");
-				strcat(writeParam, cwd);
-				fprintf(fptr,"%s\n", writeParam);
-				
-				
-				
-			}else if(strcmp(param, "jump") == 0){
-				char * line = NULL;
-				size_t len = 0;
-				ssize_t read;
-				//iterate through chdirMem.txt line by line
-				while ((read = getline(&line, &len, fptr)) != -1) {
-					// printf("%s", line); //uncomment for debug
-					//parse file to bits
-					char* token = strtok(line, "$:");
-					
-					int count = 0;// 0 for pathAlias & 1 for pathDir
-					char * pathAlias = malloc(sizeof(char)*1000);
-					char * pathDir = malloc(sizeof(char)*1000);
-					while (token != NULL) {
-						if(count == 0){
-							strcpy(pathAlias, token);
-						}else if(count == 1){
-							strcpy(pathDir, token);
-						}
-						token = strtok(NULL, "$");
-						count++;
-					}
-					
-					
-
-					if(strcmp(param2, pathAlias) == 0){// if the current alias mathces the passed param
-						//chdir to pathDir
-						pathDir[strlen(pathDir) - 1] = '\0';
-			
-						r=chdir(pathDir);
-						if (r==-1){//if error occurs report it
-							printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-						}
-
-						
-					}
-
-					free(pathAlias);
-					free(pathDir);
-					
-				}
-			
-			
-			}else if(strcmp(param, "del") == 0){
-				char * fullTextFile = NULL;
-				fullTextFile = malloc(sizeof(char) * 100000);
-				
-				char * line = NULL;
-				size_t len = 0;
-				ssize_t read;
-				//iterate through chdirMem.txt line by line
-				while ((read = getline(&line, &len, fptr)) != -1) {
-					// printf("%s", line); //uncomment for debug
-					//parse file to bits
-					char* token = strtok(line, "$");
-					
-					int count = 0;// 0 for pathAlias & 1 for pathDir
-					char * pathAlias = NULL;
-					char * pathDir = NULL;
-					pathAlias = malloc(sizeof(char)*1000);
-					pathDir = malloc(sizeof(char)*1000);
-					while (token != NULL) {
-						if(count == 0){
-							strcpy(pathAlias, token);
-						}else if(count == 1){
-							strcpy(pathDir, token);
-						}
-						token = strtok(NULL, "$");
-						count++;
-					}
-					
-					
-
-					if(strcmp(param2, pathAlias) != 0){// if the current alias doesn't match the passed param
-						char * temp = malloc(sizeof(char)* 1000);
-						strcpy(temp, pathAlias);
-						strcat(temp,"$");
-						strcat(temp, pathDir);
-						strcat(fullTextFile, temp);//add the lines fullTextFile
-					}
-					free(pathAlias);
-					free(pathDir);
-				}
-				//delete the file
-				remove(chdirMemPath);
-				fclose(fptr);
-				//create the text file again
-				fptr = NULL;
-				//file is open for both reading and appending & if file doesn't exists it is created
-				
-				fptr = fopen(chdirMemPath,"a+"); 
-				
-				if(fptr == NULL){
-					printf("Error!");   			
-				}
 
-				//write lines back to file
-				fprintf(fptr,"%s\n", fullTextFile);
-				
-				free(fullTextFile);
+		//write crontab info to the file
+		fprintf(fptr,"%s %s * * * DISPLAY=:0.0 rhythmbox-client --play-uri %s\n", scheduledMinute, scheduledHour, scheduledMusic);
+		fclose(fptr);
+
+		//run crontab on crontfile.txt
+		pid_t pid=fork();
+		if (pid==0){//execvp called in fork() to prevent parent from terminating the seashell
+			char * arr[] = {"crontab",cronFilePath,NULL};
+			execvp("crontab", arr);
+			exit(127);
+		}else{//parent
+			waitpid(pid, NULL, 0);
+			return SUCCESS;
+		} 
 				
-				fclose(fptr);
-				return SUCCESS;
+	}
+	return builtin_usage(command);
+}
+/**
+ * highlight engine. Input is read in large blocks and scanned in place;
+ * unmatched spans are copied to an output buffer that goes out in large
+ * writes, so memory stays bounded by the two buffers whatever the input
+ * size. Whitespace is copied through untouched.
+ *
+ * The keywords are compiled once into an Aho-Corasick automaton whose
+ * failure links are folded into a full transition table, so scanning
+ * costs one table lookup per input byte however many keywords there are.
+ */
+#define HIGHLIGHT_BLOCK (1<<20) // input read size
+#define HIGHLIGHT_OUT (1<<18) // output buffered before a write
+#define HIGHLIGHT_MAX_KEYWORD 4096 // must stay well below HIGHLIGHT_BLOCK
+#define HIGHLIGHT_MAX_STATES (1<<18)
+#define HIGHLIGHT_CHUNK (4<<20) // bytes per task with -j, rounded up to a line end
+#define HIGHLIGHT_MAX_THREADS 256
+struct out_buffer {
+	int fd; // -1 for a memory buffer, which grows instead of flushing
+	char *data;
+	size_t len;
+	size_t capacity;
+	bool failed; // a write failed, the rest is dropped
+};
+struct highlight_keyword {
+	size_t len;
+	const char *color; // escape sequence put before a match
+};
+struct highlight_t {
+	int *next; // next[state*256+byte]; state 0 is the root
+	int *match; // per state, the longest keyword ending there, or -1
+	int *depth; // per state, the length of the keyword prefix it stands for
+	int state_count;
+	int state_capacity;
+	struct highlight_keyword *keywords;
+	int keyword_count;
+	size_t max_len;
+	bool ignore_case; // ASCII letters match either case
+	bool substring; // match anywhere, not just whole tokens
+	bool interruptible; // runs for the shell itself, stops on ^C
+};
+static const struct {
+	const char *name;
+	const char *color;
+} highlight_colors[]={
+	{"r", "\x1B[41m"},
+	{"g", "\x1B[42m"},
+	{"b", "\x1B[44m"},
+	{"y", "\x1B[43m"},
+	{"m", "\x1B[45m"},
+	{"c", "\x1B[46m"},
+};
+static void out_flush(struct out_buffer *out)
+{
+	size_t done=0;
+	while (done<out->len && !out->failed)
+	{
+		ssize_t n=write(out->fd, out->data+done, out->len-done);
+		if (n==-1 && errno==EINTR) continue;
+		if (n<=0) out->failed=true;
+		else done+=n;
+	}
+	out->len=0;
+}
+static void out_write(struct out_buffer *out, const void *data, size_t len)
+{
+	if (out->len+len>out->capacity && out->fd==-1)
+	{
+		while (out->len+len>out->capacity)
+			out->capacity*=2;
+		out->data=realloc(out->data, out->capacity);
+	}
+	else if (out->len+len>out->capacity)
+	{
+		out_flush(out);
+		if (len>=out->capacity)
+		{ // big spans skip the copy
+			struct out_buffer direct={out->fd, (char *)data, len, len, out->failed};
+			out_flush(&direct);
+			out->failed=direct.failed;
+			return;
+		}
+	}
+	memcpy(out->data+out->len, data, len);
+	out->len+=len;
+}
+static inline bool highlight_space(unsigned char c)
+{
+	return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
+}
+static inline unsigned char highlight_fold(unsigned char c)
+{
+	return c>='A' && c<='Z' ? c+'a'-'A' : c;
+}
+/**
+ * Escape sequence for a color name
+ * @param  name r, g, b, y, m or c
+ * @return      NULL if unknown
+ */
+static const char *highlight_color(const char *name)
+{
+	for (size_t i=0;i<sizeof(highlight_colors)/sizeof(highlight_colors[0]);++i)
+		if (strcmp(name, highlight_colors[i].name)==0)
+			return highlight_colors[i].color;
+	return NULL;
+}
+static void highlight_init(struct highlight_t *h, bool ignore_case, bool substring)
+{
+	*h=(struct highlight_t){.state_count=1, .state_capacity=64, .ignore_case=ignore_case, .substring=substring};
+	h->next=calloc(h->state_capacity*256, sizeof(int));
+	h->match=malloc(h->state_capacity*sizeof(int));
+	h->depth=malloc(h->state_capacity*sizeof(int));
+	memset(h->match, -1, h->state_capacity*sizeof(int));
+	h->depth[0]=0;
+}
+static void highlight_free(struct highlight_t *h)
+{
+	free(h->next);
+	free(h->match);
+	free(h->depth);
+	free(h->keywords);
+}
+/**
+ * Add a keyword to the trie, before highlight_compile. A keyword given
+ * twice keeps its first color.
+ * @param  h     [description]
+ * @param  word  [description]
+ * @param  len   [description]
+ * @param  color escape sequence
+ * @return       -1 if the keyword is empty, too long, spans lines, or the
+ *               automaton is full
+ */
+static int highlight_add(struct highlight_t *h, const char *word, size_t len, const char *color)
+{
+	if (len==0 || len>HIGHLIGHT_MAX_KEYWORD || memchr(word, '\n', len)) return -1; // -j splits at line ends
+	int state=0;
+	for (size_t i=0;i<len;++i)
+	{
+		unsigned char c=h->ignore_case ? highlight_fold(word[i]) : (unsigned char)word[i];
+		if (h->next[state*256+c]==0)
+		{ // the root is nobody's child, so 0 means no edge yet
+			if (h->state_count==HIGHLIGHT_MAX_STATES) return -1;
+			if (h->state_count==h->state_capacity)
+			{
+				h->next=realloc(h->next, 2*h->state_capacity*256*sizeof(int));
+				h->match=realloc(h->match, 2*h->state_capacity*sizeof(int));
+				h->depth=realloc(h->depth, 2*h->state_capacity*sizeof(int));
+				memset(h->next+h->state_capacity*256, 0, h->state_capacity*256*sizeof(int));
+				memset(h->match+h->state_capacity, -1, h->state_capacity*sizeof(int));
+				h->state_capacity*=2;
 			}
-			fclose(fptr);
-			return SUCCESS;
-			}else if(command->arg_count == 1){//can be {clear, list} ops.
-				if(strcmp(param, "clear") == 0){
-					remove(chdirMemPath);
-					return SUCCESS;
-					
-				}else if(strcmp(param, "list") == 0){
-					char * line = NULL;
-					size_t len = 0;
-					ssize_t read;
-					//iterate through chdirMem.txt line by line
-					while ((read = getline(&line, &len, fptr)) != -1) {
-						// printf("%s", line); //uncomment for debug
-						//parse file to bits
-						char* token = strtok(line, "$");
-						
-						int count = 0;// 0 for pathAlias & 1 for pathDir
-						char * pathAlias = NULL;
-						char * pathDir = NULL;
-						pathAlias = malloc(sizeof(char)*1000);
-						pathDir = malloc(sizeof(char)*1000);
-						while (token != NULL) {
-							if(count == 0){
-								strcpy(pathAlias, token);
-							}else if(count == 1){
-								strcpy(pathDir, token);
-							}
-							token = strtok(NULL, "$");
-							count++;
-						}
-						if(strlen(pathDir) > 0 && strlen(pathAlias)){
-							printf("name: %s directory: %s\n", pathAlias, pathDir);	
-						}
-						
-						free(pathAlias);
-						free(pathDir);
-				}
-				fclose(fptr);
-				return SUCCESS;
+			h->depth[h->state_count]=h->depth[state]+1;
+			h->next[state*256+c]=h->state_count++;
+		}
+		state=h->next[state*256+c];
+	}
+	if (h->match[state]!=-1) return 0;
+	if ((h->keyword_count & (h->keyword_count-1))==0) // 0 or a power of two: full
+		h->keywords=realloc(h->keywords, (h->keyword_count ? 2*h->keyword_count : 1)*sizeof(struct highlight_keyword));
+	h->keywords[h->keyword_count]=(struct highlight_keyword){len, color};
+	h->match[state]=h->keyword_count++;
+	if (len>h->max_len) h->max_len=len;
+	return 0;
+}
+/**
+ * Turn the keyword trie into a complete automaton: a breadth first walk
+ * gives every state its failure link, fills each missing edge with the
+ * failure state's edge, and passes matches down the failure links
+ * @param h [description]
+ */
+static void highlight_compile(struct highlight_t *h)
+{
+	int *fail=malloc(h->state_count*sizeof(int));
+	int *queue=malloc(h->state_count*sizeof(int));
+	int head=0, tail=0;
+	for (int c=0;c<256;++c)
+		if (h->next[c])
+		{
+			fail[h->next[c]]=0;
+			queue[tail++]=h->next[c];
+		}
+	while (head<tail)
+	{
+		int state=queue[head++];
+		int *edges=h->next+state*256, *fallback=h->next+fail[state]*256;
+		if (h->match[state]==-1) // a keyword ending here is the longest one
+			h->match[state]=h->match[fail[state]];
+		for (int c=0;c<256;++c)
+		{
+			if (edges[c])
+			{
+				fail[edges[c]]=fallback[c];
+				queue[tail++]=edges[c];
 			}
+			else
+				edges[c]=fallback[c];
 		}
-
-
-		fclose(fptr);
-		free(chdirMemPath);
-		
 	}
-
-
-	//using execv() and solving the path. implementation of Question1
-	pid_t pid=fork();
-	if (pid==0) // child
+	if (h->ignore_case)
+		for (int state=0;state<h->state_count;++state)
+			for (int c='A';c<='Z';++c)
+				h->next[state*256+c]=h->next[state*256+c+'a'-'A'];
+	free(fail);
+	free(queue);
+}
+/**
+ * Read keywords from a file, one "keyword color" per line. The color is
+ * the last word, so in substring mode keywords may contain spaces; empty
+ * lines and lines starting with # are skipped.
+ * @param  command [description]
+ * @param  h       [description]
+ * @param  path    [description]
+ * @return         0, or -1 after printing an error
+ */
+static int highlight_load(struct command_t *command, struct highlight_t *h, const char *path)
+{
+	FILE *file=fopen(path, "r");
+	if (!file)
 	{
-		/// This shows how to do exec with environ (but is not available on MacOs)
-	    // extern char** environ; // environment variables
-		// execvpe(command->name, command->args, environ); // exec+args+path+environ
-
-		/// This shows how to do exec with no auto-path resolve
-		// add a NULL argument to the end of args, and the name to the beginning
-		// as required by exec
-
-		// increase args size by 2
-		command->args=(char **)realloc(
-			command->args, sizeof(char *)*(command->arg_count+=2));
-
-		// shift everything forward by 1
-		for (int i=command->arg_count-2;i>0;--i)
-			command->args[i]=command->args[i-1];
-
-		// set args[0] as a copy of name
-		command->args[0]=strdup(command->name);
-		// set args[arg_count-1] (last) to NULL
-		command->args[command->arg_count-1]=NULL;
-
-		//execvp(command->name, command->args); // exec+args+path
-		/// TODO: do your own exec with path resolving using execv()
-		//attain the $PATH variable
-		const char* path = getenv("PATH");
-
-		char* token = strtok(path, ":");
-
-		while( token != NULL ) {
-			//check for the validity
-			char * argsPath = malloc(sizeof(char) * strlen(token));
-			strcat(argsPath,token);
-			strcat(argsPath, "/");
-			strcat(argsPath,(command->name));
-			int result = access(argsPath, F_OK);
-
-
-			//printf("%s \n", token);
-
-			if(result == 0){//if command exists in the path
-				strcpy(command->args[0], argsPath);
-				execv(argsPath, command->args);
-
-			}else{//if command doesn't exist in the path
-				token = strtok(NULL, ":");
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path, strerror(errno));
+		return -1;
+	}
+	char *line=NULL;
+	size_t capacity=0, number=0;
+	ssize_t len;
+	int result=0;
+	while (result==0 && (len=getline(&line, &capacity, file))!=-1)
+	{
+		number++;
+		while (len>0 && highlight_space(line[len-1])) line[--len]=0;
+		if (len==0 || line[0]=='#') continue;
+		char *color=line+len;
+		while (color>line && !highlight_space(color[-1])) color--;
+		size_t word_len=color-line;
+		while (word_len>0 && highlight_space(line[word_len-1])) word_len--;
+		const char *escape=highlight_color(color);
+		if (!escape || highlight_add(h, line, word_len, escape)==-1)
+		{
+			printf("-%s: %s: %s:%zu: invalid keyword line\n", sysname, command->name, path, number);
+			result=-1;
+		}
+	}
+	free(line);
+	fclose(file);
+	return result;
+}
+static void highlight_match(const struct highlight_t *h, int keyword, const unsigned char *data, size_t *span,
+	size_t start, size_t end, struct out_buffer *out)
+{
+	out_write(out, data+*span, start-*span);
+	out_write(out, h->keywords[keyword].color, strlen(h->keywords[keyword].color));
+	out_write(out, data+start, end-start);
+	out_write(out, "\x1B[0m", 4);
+	*span=end;
+}
+/**
+ * Highlight the whitespace separated tokens of a buffer that are keywords
+ * @param  h     [description]
+ * @param  data  [description]
+ * @param  len   [description]
+ * @param  final no more input follows
+ * @param  out   [description]
+ * @return       bytes consumed; unless final, a token running to the end
+ *               of the buffer is left for the next call
+ */
+static size_t highlight_tokens(const struct highlight_t *h, const unsigned char *data, size_t len, bool final,
+	struct out_buffer *out)
+{
+	size_t span=0, i=0; // data[span..] is copied through unchanged
+	while (i<len)
+	{
+		while (i<len && highlight_space(data[i])) i++;
+		size_t start=i;
+		int state=0;
+		while (i<len && !highlight_space(data[i]))
+			state=h->next[state*256+data[i++]];
+		if (i==len && !final)
+		{
+			out_write(out, data+span, start-span);
+			return start;
+		}
+		// the walk started at the token, so a match this long is the token
+		int keyword=h->match[state];
+		if (keyword!=-1 && h->keywords[keyword].len==i-start)
+			highlight_match(h, keyword, data, &span, start, i, out);
+	}
+	out_write(out, data+span, len-span);
+	return len;
+}
+/**
+ * Highlight keywords anywhere in a buffer. Of overlapping matches the
+ * leftmost wins, and of those the longest. Once a match is found the scan
+ * goes on only while the automaton state still reaches back to its start,
+ * as only then can a longer or earlier match be pending.
+ * @param  h     [description]
+ * @param  data  [description]
+ * @param  len   [description]
+ * @param  final no more input follows
+ * @param  out   [description]
+ * @return       bytes consumed; unless final, the last max_len-1 bytes
+ *               are left for the next call, as a match may start there
+ */
+static size_t highlight_substrings(const struct highlight_t *h, const unsigned char *data, size_t len, bool final,
+	struct out_buffer *out)
+{
+	// a match starting before safe ends inside the buffer
+	size_t safe=final ? len : len>h->max_len-1 ? len-(h->max_len-1) : 0;
+	const unsigned char *line_end=memrchr(data+safe, '\n', len-safe);
+	if (line_end) // nor does one span lines, so a following reader sees whole lines at once
+		safe=line_end-data+1;
+	size_t span=0, i=0; // data[span..] is copied through unchanged
+	int state=0;
+	while (i<len)
+	{
+		state=h->next[state*256+data[i++]];
+		int keyword=h->match[state];
+		if (keyword==-1) continue;
+		size_t start=i-h->keywords[keyword].len, end=i;
+		while (i<len)
+		{
+			int next=h->next[state*256+data[i]];
+			if ((size_t)h->depth[next]<i+1-start) break; // depths are never negative
+			state=next;
+			i++;
+			int longer=h->match[state];
+			if (longer!=-1 && i-h->keywords[longer].len<=start)
+			{
+				keyword=longer;
+				start=i-h->keywords[longer].len;
+				end=i;
 			}
+		}
+		if (start>=safe) break; // found again by the next call
+		highlight_match(h, keyword, data, &span, start, end, out);
+		i=end; // the lookahead is scanned again, from the root
+		state=0;
+	}
+	size_t used=span>safe ? span : safe;
+	out_write(out, data+span, used-span);
+	return used;
+}
+static size_t highlight_buffer(const struct highlight_t *h, const unsigned char *data, size_t len, bool final,
+	struct out_buffer *out)
+{
+	if (h->substring)
+		return highlight_substrings(h, data, len, final, out);
+	return highlight_tokens(h, data, len, final, out);
+}
+/**
+ * Highlight everything readable from a descriptor
+ * @param  h      [description]
+ * @param  in     input descriptor
+ * @param  follow flush after every read, for pipes and terminals that may
+ *                be fed slowly (tail -f)
+ * @param  out    [description]
+ * @return        0, or -1 on a read error
+ */
+int highlight_stream(const struct highlight_t *h, int in, bool follow, struct out_buffer *out)
+{
+	unsigned char *buf=malloc(HIGHLIGHT_BLOCK);
+	size_t filled=0;
+	bool skipping=false; // inside a token longer than the block
+	while (1)
+	{
+		ssize_t n=read(in, buf+filled, HIGHLIGHT_BLOCK-filled);
+		if (h->interruptible && atomic_load(&interrupted))
+			break;
+		if (n==-1 && errno==EINTR) continue;
+		if (n==-1)
+		{
+			free(buf);
+			return -1;
+		}
+		filled+=n;
+		size_t used=0;
+		if (skipping)
+		{
+			while (used<filled && !highlight_space(buf[used])) used++;
+			out_write(out, buf, used);
+			skipping=used==filled;
+		}
+		used+=highlight_buffer(h, buf+used, filled-used, n==0, out);
+		if (follow)
+			out_flush(out);
+		if (n==0 || out->failed) break; // nobody reads the rest
+		if (used==0 && filled==HIGHLIGHT_BLOCK)
+		{ // one token fills the block, it can't be a keyword
+			out_write(out, buf, filled);
+			used=filled;
+			skipping=true;
+		}
+		memmove(buf, buf+used, filled-used);
+		filled-=used;
+	}
+	free(buf);
+	return 0;
+}
+/**
+ * highlight -j: the mapped input is cut into chunks at line ends, which
+ * no match spans, and workers highlight chunks into memory buffers. The
+ * calling thread writes the buffers out in order. Workers stay within a
+ * window of chunks past the one being written, so memory is bounded by
+ * the window whatever the input size.
+ */
+struct highlight_parallel_t {
+	const struct highlight_t *h;
+	const unsigned char *data;
+	size_t *bounds; // chunk i is data[bounds[i]..bounds[i+1])
+	size_t count;
+	struct out_buffer *slots; // chunk i goes to slots[i%window]
+	bool *ready;
+	size_t window;
+	size_t next; // next chunk to hand out
+	size_t written; // chunks written so far
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+static void *highlight_worker(void *arg)
+{
+	struct highlight_parallel_t *job=arg;
+	pthread_mutex_lock(&job->lock);
+	while (job->next<job->count)
+	{
+		if (job->next>=job->written+job->window)
+		{
+			pthread_cond_wait(&job->changed, &job->lock);
+			continue;
+		}
+		size_t i=job->next++;
+		struct out_buffer *slot=&job->slots[i%job->window];
+		pthread_mutex_unlock(&job->lock);
+		slot->len=0;
+		highlight_buffer(job->h, job->data+job->bounds[i], job->bounds[i+1]-job->bounds[i], true, slot);
+		pthread_mutex_lock(&job->lock);
+		job->ready[i%job->window]=true;
+		pthread_cond_broadcast(&job->changed);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+/**
+ * Highlight a mapped file on a pool of threads
+ * @param  h       [description]
+ * @param  data    [description]
+ * @param  size    [description]
+ * @param  threads [description]
+ * @param  out     [description]
+ */
+static void highlight_parallel(const struct highlight_t *h, const unsigned char *data, size_t size, int threads,
+	struct out_buffer *out)
+{
+	struct highlight_parallel_t job={.h=h, .data=data, .window=2*threads};
+	job.bounds=malloc((size/HIGHLIGHT_CHUNK+2)*sizeof(size_t));
+	job.bounds[0]=0;
+	while (job.bounds[job.count]<size)
+	{
+		size_t at=job.bounds[job.count]+HIGHLIGHT_CHUNK;
+		const unsigned char *line_end=at<size ? memchr(data+at, '\n', size-at) : NULL;
+		job.bounds[++job.count]=line_end ? (size_t)(line_end-data)+1 : size;
+	}
+	job.slots=malloc(job.window*sizeof(struct out_buffer));
+	job.ready=calloc(job.window, sizeof(bool));
+	for (size_t i=0;i<job.window;++i)
+		job.slots[i]=(struct out_buffer){-1, malloc(HIGHLIGHT_CHUNK), 0, HIGHLIGHT_CHUNK, false};
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.changed, NULL);
 
-			
-			
+	pthread_t ids[HIGHLIGHT_MAX_THREADS];
+	int started=0;
+	for (int t=0;t<threads;++t)
+		if (pthread_create(&ids[started], NULL, highlight_worker, &job)==0)
+			started++;
+	if (started==0)
+		job.count=0; // nobody to do the work
+	for (size_t i=0;i<job.count;++i)
+	{
+		struct out_buffer *slot=&job.slots[i%job.window];
+		pthread_mutex_lock(&job.lock);
+		while (!job.ready[i%job.window])
+			pthread_cond_wait(&job.changed, &job.lock);
+		pthread_mutex_unlock(&job.lock);
+		out_write(out, slot->data, slot->len);
+		pthread_mutex_lock(&job.lock);
+		job.ready[i%job.window]=false;
+		job.written++;
+		if (out->failed || (h->interruptible && atomic_load(&interrupted))) // the reader is gone, or ^C
+			job.count=job.next;
+		pthread_cond_broadcast(&job.changed);
+		pthread_mutex_unlock(&job.lock);
+	}
+	for (int t=0;t<started;++t)
+		pthread_join(ids[t], NULL);
+	if (started==0)
+		highlight_buffer(h, data, size, true, out);
+	pthread_mutex_destroy(&job.lock);
+	pthread_cond_destroy(&job.changed);
+	for (size_t i=0;i<job.window;++i)
+		free(job.slots[i].data);
+	free(job.slots);
+	free(job.ready);
+	free(job.bounds);
+}
+/**
+ * Parse highlight's arguments and highlight the named file, or in if
+ * there is none
+ * @param  command       [description]
+ * @param  in            input when no file is named
+ * @param  out_fd        [description]
+ * @param  interruptible stop on ^C; not for thread stages, which belong
+ *                       to their job
+ * @return               SUCCESS
+ */
+static int highlight_main(struct command_t *command, int in, int out_fd, bool interruptible)
+{
+	bool ignore_case=false, substring=false;
+	const char *keyfile=NULL;
+	long threads=1;
+	int i=0;
+	for (;i<command->arg_count && command->args[i][0]=='-';++i)
+	{
+		const char *option=command->args[i];
+		if (strcmp(option, "-i")==0)
+			ignore_case=true;
+		else if (strcmp(option, "-s")==0)
+			substring=true;
+		else if (strcmp(option, "-f")==0 && i+1<command->arg_count)
+			keyfile=command->args[++i];
+		else if (strcmp(option, "-j")==0 && i+1<command->arg_count)
+		{
+			char *end;
+			threads=strtol(command->args[++i], &end, 10);
+			if (*end || threads<1 || threads>HIGHLIGHT_MAX_THREADS)
+				return builtin_usage(command);
 		}
-		
-		exit(0);
-		
+		else if (strcmp(option, "--")==0)
+		{
+			++i;
+			break;
+		}
+		else
+			return builtin_usage(command);
 	}
-	else
+	int pairs=(command->arg_count-i)/2;
+	if (pairs==0 && !keyfile)
+		return builtin_usage(command);
+	struct highlight_t h;
+	highlight_init(&h, ignore_case, substring);
+	for (;pairs>0;--pairs, i+=2)
+	{
+		const char *color=highlight_color(command->args[i+1]);
+		if (!color || highlight_add(&h, command->args[i], strlen(command->args[i]), color)==-1)
+		{
+			highlight_free(&h);
+			return builtin_usage(command);
+		}
+	}
+	if (keyfile && highlight_load(command, &h, keyfile)==-1)
 	{
-		if (!command->background)
-			wait(0); // wait for child process to finish
+		highlight_free(&h);
 		return SUCCESS;
 	}
+	highlight_compile(&h);
+	h.interruptible=interruptible;
 
-	// TODO: your implementation here
-	
-	printf("-%s: %s: command not found\n", sysname, command->name);
-	return UNKNOWN;
+	const char *path=i<command->arg_count ? command->args[i] : NULL;
+	int fd=path ? open(path, O_RDONLY | O_CLOEXEC) : in;
+	if (fd==-1)
+	{
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path, strerror(errno));
+		highlight_free(&h);
+		return SUCCESS;
+	}
+	struct out_buffer out={out_fd, malloc(HIGHLIGHT_OUT), 0, HIGHLIGHT_OUT, false};
+	struct stat st;
+	void *map=MAP_FAILED;
+	bool regular=fstat(fd, &st)==0 && S_ISREG(st.st_mode);
+	if (threads>1 && regular && st.st_size>HIGHLIGHT_CHUNK)
+		map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map!=MAP_FAILED)
+	{ // smaller files and ones that can't be mapped are streamed
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		highlight_parallel(&h, map, st.st_size, threads, &out);
+		munmap(map, st.st_size);
+	}
+	else if (highlight_stream(&h, fd, !regular, &out)==-1)
+		printf("-%s: %s: %s: %s\n", sysname, command->name, path ? path : "stdin", strerror(errno));
+	out_flush(&out);
+	free(out.data);
+	if (path)
+		close(fd);
+	highlight_free(&h);
+	return SUCCESS;
+}
+/**
+ * highlight command. implementation of Question3, extended to any number
+ * of keywords: given as word color pairs, or read from a file with -f.
+ * -i ignores case, -s matches inside tokens too, -j highlights a large
+ * file on a pool of threads. Without a file it filters stdin.
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_highlight(struct command_t *command)
+{
+	fflush(stdout); // output goes straight to the descriptor from here
+	return highlight_main(command, STDIN_FILENO, STDOUT_FILENO, true);
+}
+/**
+ * highlight as a pipeline stage, on a thread of the shell
+ */
+static int highlight_stage(struct command_t *command, int in, int out)
+{
+	return highlight_main(command, in, out, false);
+}
+/**
+ * shortdir command. implementation of Question2
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_shortdir(struct command_t *command)
+{
+	shortdir_load();
+	if (command->arg_count==2)// can be {set, jump, del} ops.
+	{
+		const char *op=command->args[0], *alias=command->args[1];
+		if (strcmp(op, "set")==0)
+		{
+			char cwd[PATH_MAX];
+			if (alias[strcspn(alias, "$\n")]) // can't be told apart from the directory
+				return builtin_usage(command);
+			if (getcwd(cwd, sizeof(cwd))==NULL)
+			{
+				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+				return SUCCESS;
+			}
+			shortdir_put(alias, cwd);
+			shortdir_save(command);
+			return SUCCESS;
+		}
+		if (strcmp(op, "jump")==0 || strcmp(op, "del")==0)
+		{
+			struct shortdir_entry *entry=shortdir_find(alias);
+			if (entry==NULL)
+				printf("-%s: %s: %s: no such alias\n", sysname, command->name, alias);
+			else if (op[0]=='d')
+			{
+				shortdir_del(alias);
+				shortdir_save(command);
+			}
+			else if (chdir(entry->dir)==-1)
+				printf("-%s: %s: %s: %s\n", sysname, command->name, entry->dir, strerror(errno));
+			return SUCCESS;
+		}
+	}
+	else if (command->arg_count==1)//can be {clear, list} ops.
+	{
+		if (strcmp(command->args[0], "clear")==0)
+		{
+			char path[sizeof(cd)+sizeof(SHORTDIR_FILE)+1];
+			snprintf(path, sizeof(path), "%s/%s", cd, SHORTDIR_FILE);
+			shortdir_clear();
+			memset(&shortdir.st, 0, sizeof(shortdir.st));
+			if (remove(path)==-1 && errno!=ENOENT)
+				printf("-%s: %s: %s: %s\n", sysname, command->name, path, strerror(errno));
+			return SUCCESS;
+		}
+		if (strcmp(command->args[0], "list")==0)
+		{
+			for (size_t i=0;i<shortdir.count;++i)
+				if (shortdir.entries[i].alias)
+					printf("name: %s directory: %s\n", shortdir.entries[i].alias, shortdir.entries[i].dir);
+			return SUCCESS;
+		}
+	}
+	return builtin_usage(command);
+}
+/**
+ * Builtin registry. Slots are a perfect hash of (length, first char,
+ * last char), computed at compile time from the designated initializers,
+ * so finding a builtin costs one strlen and one strcmp however many there
+ * are. A new name must land on a free slot: build with -Wextra, whose
+ * -Woverride-init reports a collision.
+ */
+#define BUILTIN_SLOT(first, last, len) (((len)+(first)*3+(last)*10)&(BUILTIN_SLOTS-1))
+static const struct builtin_t builtins[BUILTIN_SLOTS]={
+	[BUILTIN_SLOT('e', 't', 4)]={"exit", builtin_exit, BUILTIN_PARENT, "exit"},
+	[BUILTIN_SLOT('c', 'd', 2)]={"cd", builtin_cd, BUILTIN_PARENT, "cd [dir]"},
+	[BUILTIN_SLOT('b', 'a', 4)]={"baca", builtin_baca, 0, "baca"},
+	[BUILTIN_SLOT('k', 'f', 5)]={"kdiff", builtin_kdiff, BUILTIN_PIPELINE, "kdiff [-j threads] [--no-cache | --verify] [-a | -b [-n count] | -r] path1 path2 | kdiff [-j threads] --dups [--compare] path..."},
+	[BUILTIN_SLOT('g', 'g', 11)]={"goodMorning", builtin_goodMorning, 0, "goodMorning hour.minute music_file"},
+	[BUILTIN_SLOT('h', 't', 9)]={"highlight", builtin_highlight, BUILTIN_PIPELINE, "highlight [-i] [-s] [-j threads] [-f keyfile] [word r|g|b|y|m|c]... [file]", highlight_stage},
+	[BUILTIN_SLOT('s', 'r', 8)]={"shortdir", builtin_shortdir, BUILTIN_PARENT | BUILTIN_PIPELINE, "shortdir set|jump|del name | shortdir list|clear"},
+	[BUILTIN_SLOT('h', 'h', 4)]={"hash", builtin_hash, BUILTIN_PARENT | BUILTIN_PIPELINE, "hash [-r] [name...]"},
+	[BUILTIN_SLOT('j', 's', 4)]={"jobs", builtin_jobs, BUILTIN_PARENT | BUILTIN_PIPELINE, "jobs"},
+	[BUILTIN_SLOT('w', 't', 4)]={"wait", builtin_wait, BUILTIN_PARENT, "wait [%n|pid...]"},
+	[BUILTIN_SLOT('f', 'g', 2)]={"fg", builtin_fg_bg, BUILTIN_PARENT, "fg [%n]"},
+	[BUILTIN_SLOT('b', 'g', 2)]={"bg", builtin_fg_bg, BUILTIN_PARENT, "bg [%n]"},
+	[BUILTIN_SLOT('t', 'e', 4)]={"time", builtin_time, BUILTIN_PARENT | BUILTIN_PREFIX, "time [-c] command..."},
+	[BUILTIN_SLOT('h', 'p', 4)]={"help", builtin_help, BUILTIN_PIPELINE, "help"},
+	[BUILTIN_SLOT('h', 'y', 7)]={"history", builtin_history, BUILTIN_PARENT | BUILTIN_PIPELINE, "history [n]"},
+};
+const struct builtin_t *find_builtin(const char *name)
+{
+	size_t len=strlen(name);
+	if (len==0) return NULL;
+	const struct builtin_t *builtin=&builtins[BUILTIN_SLOT((unsigned char)name[0], (unsigned char)name[len-1], len)];
+	if (builtin->name && strcmp(builtin->name, name)==0)
+		return builtin;
+	return NULL;
+}
+/**
+ * Registry entry in a slot, for walking all builtins
+ * @param  slot 0..BUILTIN_SLOTS-1
+ * @return      builtin, or NULL for an empty slot
+ */
+const struct builtin_t *builtin_slot(int slot)
+{
+	return builtins[slot].name?&builtins[slot]:NULL;
+}
+static int builtin_compare(const void *a, const void *b)
+{
+	return strcmp((*(const struct builtin_t **)a)->name, (*(const struct builtin_t **)b)->name);
+}
+/**
+ * help builtin: list builtins and their usage from the registry
+ * @param  command [description]
+ * @return         SUCCESS
+ */
+int builtin_help(struct command_t *command)
+{
+	(void)command;
+	const struct builtin_t *sorted[BUILTIN_SLOTS];
+	int count=0;
+	for (int i=0;i<BUILTIN_SLOTS;++i)
+		if (builtins[i].name)
+			sorted[count++]=&builtins[i];
+	qsort(sorted, count, sizeof(sorted[0]), builtin_compare);
+	printf("%s builtins:\n", sysname);
+	for (int i=0;i<count;++i)
+		printf("  %s\n", sorted[i]->usage);
+	return SUCCESS;
+}
+int builtin_usage(struct command_t *command)
+{
+	const struct builtin_t *builtin=find_builtin(command->name);
+	printf("-%s: %s: usage: %s\n", sysname, command->name, builtin?builtin->usage:command->name);
+	return SUCCESS;
+}
+
+int process_command(struct command_t *command)
+{
+	if (strcmp(command->name, "")==0) return SUCCESS;
+
+	const struct builtin_t *builtin=find_builtin(command->name);
+	if (builtin && (builtin->flags & BUILTIN_PREFIX)) // may time a whole pipeline
+		return builtin->handler(command);
+
+	//external commands with our own path resolving. implementation of Question1
+	if (command->next || builtin==NULL) // a | b | c
+		return run_pipeline(command);
+
+	// builtins that don't need the shell's state can go to the background
+	if (command->background && !(builtin->flags & BUILTIN_PARENT))
+		return run_pipeline(command);
+
+	if (has_redirects(command))
+		return run_redirected_builtin(command, builtin);
+
+	return builtin->handler(command);
 }